@@ -0,0 +1,226 @@
+#!/usr/bin/perl
+
+# $Id$
+#
+# Report how well the family alignments in one directory agree with those
+# in another, e.g. the alignments made by familyAlign against those made
+# by "alignAllFamilies.pl fasta" (clustalw2) for the same families.
+#
+# Both directories hold one FASTA file per family, named <family>.fasta.
+# For each family found in both, the alignments are compared by:
+#   - the sum-of-pairs score: the fraction of the pairs of residues
+#     aligned with each other in the reference alignment that are also
+#     aligned with each other in the test alignment.
+#   - the column score: the fraction of the columns of the reference
+#     alignment that are also columns of the test alignment.
+#
+# It takes two arguments:
+#   1. the directory with the reference alignments
+#   2. the directory with the alignments to be tested
+#
+# The report gives the number of families compared, the number whose
+# alignments are identical, and the two scores over all the families.
+# Each family whose alignments differ is listed on standard error with
+# its scores.
+#
+
+use strict;
+use warnings;
+
+if (@ARGV != 2)
+{
+  die "Usage: compareAlignments.pl referenceDir testDir\n";
+}
+
+my $referenceDir = shift @ARGV;
+my $testDir = shift @ARGV;
+$referenceDir =~ s/\/$//;
+$testDir =~ s/\/$//;
+
+# read an aligned family, returning a reference to a hash of the aligned
+# sequences by gene name, and a reference to a list of the gene names
+sub readAlignment
+{
+  my ($file) = @_;
+
+  my %rows = ();
+  my @names = ();
+  my $name;
+  open(IN, "<", $file) or
+    die "cannot open input ($file)\n";
+  while (my $line = <IN>)
+  {
+    chomp($line);
+    if ($line =~ /^>(\S+)/)
+    {
+      $name = $1;
+      push @names, $name;
+      $rows{$name} = "";
+    }
+    elsif (defined($name))
+    {
+      $line =~ s/\s//g;
+      $rows{$name} .= uc $line;
+    }
+  }
+  close(IN);
+
+  return (\%rows, \@names);
+}
+
+# for each column of an alignment, the position in its sequence of the
+# residue of each gene (-1 for a gap), joined into a string
+sub alignmentColumns
+{
+  my ($rows, $names) = @_;
+
+  my @positions = ();
+  my @columns = ();
+  my $length = length($rows->{$names->[0]});
+  foreach my $name (@$names)
+  {
+    if (length($rows->{$name}) != $length)
+    {
+      return undef;
+    }
+  }
+  for (my $c = 0; $c < $length; $c++)
+  {
+    my @column = ();
+    for (my $k = 0; $k < @$names; $k++)
+    {
+      if (substr($rows->{$names->[$k]}, $c, 1) eq "-")
+      {
+        push @column, -1;
+      }
+      else
+      {
+        $positions[$k] += 1;
+        push @column, $positions[$k] - 1;
+      }
+    }
+    push @columns, join(",", @column);
+  }
+
+  return \@columns;
+}
+
+# the pairs of residues aligned with each other, as "k:i,l:j" for the
+# i'th residue of gene k aligned with the j'th residue of gene l
+sub alignedPairs
+{
+  my ($columns) = @_;
+
+  my %pairs = ();
+  foreach my $column (@$columns)
+  {
+    my @position = split /,/, $column;
+    for (my $k = 0; $k < @position; $k++)
+    {
+      next if ($position[$k] < 0);
+      for (my $l = $k + 1; $l < @position; $l++)
+      {
+        next if ($position[$l] < 0);
+        $pairs{"$k:$position[$k],$l:$position[$l]"} = 1;
+      }
+    }
+  }
+
+  return \%pairs;
+}
+
+opendir(DIR, $referenceDir) or
+  die "cannot open $referenceDir\n";
+my @files = sort grep(/^[^\.].*\.fasta$/, readdir(DIR));
+closedir(DIR);
+
+my $familyCount = 0;
+my $identicalCount = 0;
+my $referencePairs = 0;
+my $sharedPairs = 0;
+my $referenceColumns = 0;
+my $sharedColumns = 0;
+foreach my $file (@files)
+{
+  next if (! -f "$testDir/$file");
+
+  my ($referenceRows, $names) = readAlignment("$referenceDir/$file");
+  my ($testRows, $testNames) = readAlignment("$testDir/$file");
+
+  # the genes must be the same, but the order of the test file does not
+  # matter, since the columns are built in the order of the reference
+  my $sameGenes = (@$names == @$testNames);
+  foreach my $name (@$names)
+  {
+    if (!defined($testRows->{$name}))
+    {
+      $sameGenes = 0;
+    }
+    else
+    {
+      my $a = $referenceRows->{$name};
+      my $b = $testRows->{$name};
+      $a =~ s/-//g;
+      $b =~ s/-//g;
+      $sameGenes = 0 if ($a ne $b);
+    }
+  }
+  if (!$sameGenes || @$names == 0)
+  {
+    die "$file: the alignments are not of the same sequences\n";
+  }
+
+  my $referenceColumnList = alignmentColumns($referenceRows, $names);
+  my $testColumnList = alignmentColumns($testRows, $names);
+  if (!defined($referenceColumnList) || !defined($testColumnList))
+  {
+    die "$file: the sequences of an alignment differ in length\n";
+  }
+
+  my $familyPairs = alignedPairs($referenceColumnList);
+  my $testPairs = alignedPairs($testColumnList);
+  my $familySharedPairs = 0;
+  foreach my $pair (keys %$familyPairs)
+  {
+    $familySharedPairs += 1 if (defined($testPairs->{$pair}));
+  }
+
+  my %testColumns = map { $_ => 1 } @$testColumnList;
+  my $familySharedColumns = 0;
+  foreach my $column (@$referenceColumnList)
+  {
+    $familySharedColumns += 1 if (defined($testColumns{$column}));
+  }
+
+  $familyCount += 1;
+  $referencePairs += keys %$familyPairs;
+  $sharedPairs += $familySharedPairs;
+  $referenceColumns += @$referenceColumnList;
+  $sharedColumns += $familySharedColumns;
+
+  if ($familySharedColumns == @$referenceColumnList &&
+      @$testColumnList == @$referenceColumnList)
+  {
+    $identicalCount += 1;
+  }
+  else
+  {
+    printf STDERR "%s: sum-of-pairs %.4f, columns %.4f\n", $file,
+      (keys %$familyPairs) ? $familySharedPairs / keys %$familyPairs : 1,
+      $familySharedColumns / @$referenceColumnList;
+  }
+}
+
+if ($familyCount == 0)
+{
+  die "no families are in both $referenceDir and $testDir\n";
+}
+
+print "families compared: $familyCount\n";
+print "identical alignments: $identicalCount\n";
+printf "sum-of-pairs score: %.4f (%d of %d aligned pairs)\n",
+  $referencePairs ? $sharedPairs / $referencePairs : 1,
+  $sharedPairs, $referencePairs;
+printf "column score: %.4f (%d of %d columns)\n",
+  $referenceColumns ? $sharedColumns / $referenceColumns : 1,
+  $sharedColumns, $referenceColumns;
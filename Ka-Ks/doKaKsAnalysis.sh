@@ -4,6 +4,13 @@
 #
 # use this version if you do not have "details" files.
 #
+# agent, October 2026
+# an optional fourth argument, "familyAlign", aligns the amino acid
+# families with familyAlign rather than running clustalw2 for each family
+# (alignAllFamilies.pl fasta $1-AA). clustalw2 remains the default until
+# familyAlign's alignments have been checked against it (see
+# compareAlignments.pl).
+#
 # Phil Hatcher, December 2013
 # reordered steps to replace gene names before running phylip
 #
@@ -12,17 +19,22 @@
 # for the family file and a third argument to specify the genome
 # order file.
 #
-# so this script takes three arguments:
+# so this script takes three arguments (and an optional fourth):
 # 1. prefix of the family file name
 # 2. extension of the family file name
 # 3. the taxon order file
+# 4. (optional) familyAlign
 #
 # This script still expects the "nuc" and "proteins" directory to
 # be "up one level" at ../nuc and ../proteins.
 
 makeFastaByFamily2.pl $1.$2 $3 nuc ../nuc $1
 makeFastaByFamily2.pl $1.$2 $3 proteins ../proteins $1
-alignAllFamilies.pl fasta $1-AA
+if [ "$4" = "familyAlign" ]; then
+  familyAlign $1-AA
+else
+  alignAllFamilies.pl fasta $1-AA
+fi
 alignAllNAbyAAFamilies.pl $1-NA $1-AA-aligned
 trimAlignedEdges.pl $1-AA-aligned $1-NA-aligned
 consensusAllFamilies.pl $1-AA-aligned-edged
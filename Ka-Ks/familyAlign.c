@@ -0,0 +1,1275 @@
+/*
+ * $Id$
+ *
+ * Align the amino acid sequences of each family in a directory of family
+ * FASTA files (made by makeFastaByFamily2.pl), as
+ * "alignAllFamilies.pl fasta" does with clustalw2, but without starting a
+ * clustalw2 process for each family. Most of the families are small
+ * (panorthologs have one gene per genome), so starting the process and
+ * moving its files cost more than the alignment itself.
+ *
+ * The alignment is done the way clustalw does it, in three steps:
+ *   1. a distance between each pair of sequences, which is one minus the
+ *      fraction of identities among the aligned residues of their global
+ *      alignment. The pairwise alignments are done with vector
+ *      instructions, aligning one sequence against a batch of others at
+ *      once, one in each lane of the vector.
+ *   2. a guide tree built from the distances by neighbor joining, and
+ *      rooted where the mean distances to the leaves on either side are
+ *      closest to equal.
+ *   3. a progressive alignment: following the guide tree, the two
+ *      profiles (alignments of the sequences below a node) are aligned by
+ *      dynamic programming, a column of one profile scoring against a
+ *      column of the other the average BLOSUM62 score of their residues.
+ * Gaps cost 11 to open and 1 to extend, except that gaps at the ends of
+ * the sequences only cost the extension. Ties are always broken the same
+ * way, so the alignment depends only on the family file, and the
+ * sequences are written in the order of the family file (which is what
+ * clustalw does with -OUTORDER=INPUT), which is the genome order used by
+ * makeFastaByFamily2.pl.
+ *
+ * The aligned families are put in the directory <family-dir>-aligned,
+ * where the family in 000123.proteins is written to 000123.fasta, in FASTA
+ * format with 60 residues per line. As clustalw does, colons in the gene
+ * names are replaced by underscores (which alignNAbyAA.pl expects) and
+ * the residues are written in upper case. The families are aligned in
+ * parallel by a number of threads.
+ *
+ * Usage: familyAlign [-threads count] protein-family-dir
+ *
+ * This must be compiled with -pthread. (Compiling with -march=native lets
+ * the compiler use the widest vector instructions of the machine.)
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <limits.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#define DEFAULT_THREADS 4
+
+#define GAP_OPEN 11
+#define GAP_EXTEND 1
+
+// residues per line of the output
+#define LINE_LENGTH 60
+
+// number of sequences aligned at once in the pairwise alignments: as many
+// 32-bit lanes as the vector registers have (wider vectors than the machine
+// has are much slower)
+#ifdef __AVX2__
+#define LANES 8
+#else
+#define LANES 4
+#endif
+
+typedef int32_t VectorInt __attribute__ ((vector_size (LANES * 4)));
+
+// small enough to never win, and far enough from INT_MIN to not overflow
+#define MINUS_INFINITY (-(1 << 28))
+
+// the residue codes are the positions in this string; everything else is X
+static const char *residueLetters = "ARNDCQEGHILKMFPSTWYVBZX*";
+#define RESIDUE_CODES 24
+#define CODE_X 22
+
+// BLOSUM62, as distributed with BLAST
+static const int blosum62[RESIDUE_CODES][RESIDUE_CODES] =
+{
+  { 4,-1,-2,-2, 0,-1,-1, 0,-2,-1,-1,-1,-1,-2,-1, 1, 0,-3,-2, 0,-2,-1, 0,-4},
+  {-1, 5, 0,-2,-3, 1, 0,-2, 0,-3,-2, 2,-1,-3,-2,-1,-1,-3,-2,-3,-1, 0,-1,-4},
+  {-2, 0, 6, 1,-3, 0, 0, 0, 1,-3,-3, 0,-2,-3,-2, 1, 0,-4,-2,-3, 3, 0,-1,-4},
+  {-2,-2, 1, 6,-3, 0, 2,-1,-1,-3,-4,-1,-3,-3,-1, 0,-1,-4,-3,-3, 4, 1,-1,-4},
+  { 0,-3,-3,-3, 9,-3,-4,-3,-3,-1,-1,-3,-1,-2,-3,-1,-1,-2,-2,-1,-3,-3,-2,-4},
+  {-1, 1, 0, 0,-3, 5, 2,-2, 0,-3,-2, 1, 0,-3,-1, 0,-1,-2,-1,-2, 0, 3,-1,-4},
+  {-1, 0, 0, 2,-4, 2, 5,-2, 0,-3,-3, 1,-2,-3,-1, 0,-1,-3,-2,-2, 1, 4,-1,-4},
+  { 0,-2, 0,-1,-3,-2,-2, 6,-2,-4,-4,-2,-3,-3,-2, 0,-2,-2,-3,-3,-1,-2,-1,-4},
+  {-2, 0, 1,-1,-3, 0, 0,-2, 8,-3,-3,-1,-2,-1,-2,-1,-2,-2, 2,-3, 0, 0,-1,-4},
+  {-1,-3,-3,-3,-1,-3,-3,-4,-3, 4, 2,-3, 1, 0,-3,-2,-1,-3,-1, 3,-3,-3,-1,-4},
+  {-1,-2,-3,-4,-1,-2,-3,-4,-3, 2, 4,-2, 2, 0,-3,-2,-1,-2,-1, 1,-4,-3,-1,-4},
+  {-1, 2, 0,-1,-3, 1, 1,-2,-1,-3,-2, 5,-1,-3,-1, 0,-1,-3,-2,-2, 0, 1,-1,-4},
+  {-1,-1,-2,-3,-1, 0,-2,-3,-2, 1, 2,-1, 5, 0,-2,-1,-1,-1,-1, 1,-3,-1,-1,-4},
+  {-2,-3,-3,-3,-2,-3,-3,-3,-1, 0, 0,-3, 0, 6,-4,-2,-2, 1, 3,-1,-3,-3,-1,-4},
+  {-1,-2,-2,-1,-3,-1,-1,-2,-2,-3,-3,-1,-2,-4, 7,-1,-1,-4,-3,-2,-2,-1,-2,-4},
+  { 1,-1, 1, 0,-1, 0, 0, 0,-1,-2,-2, 0,-1,-2,-1, 4, 1,-3,-2,-2, 0, 0, 0,-4},
+  { 0,-1, 0,-1,-1,-1,-1,-2,-2,-1,-1,-1,-1,-2,-1, 1, 5,-2,-2, 0,-1,-1, 0,-4},
+  {-3,-3,-4,-4,-2,-2,-3,-2,-2,-3,-2,-3,-1, 1,-4,-3,-2,11, 2,-3,-4,-3,-2,-4},
+  {-2,-2,-2,-3,-2,-1,-2,-3, 2,-1,-1,-2,-1, 3,-3,-2,-2, 2, 7,-1,-3,-2,-1,-4},
+  { 0,-3,-3,-3,-1,-2,-2,-3,-3, 3, 1,-2, 1,-1,-2,-2, 0,-3,-1, 4,-3,-2,-1,-4},
+  {-2,-1, 3, 4,-3, 0, 1,-1, 0,-3,-4, 0,-3,-3,-2, 0,-1,-4,-3,-3, 4, 1,-1,-4},
+  {-1, 0, 0, 1,-3, 3, 4,-2, 0,-3,-3, 1,-1,-3,-1, 0,-1,-3,-2,-2, 1, 4,-1,-4},
+  { 0,-1,-1,-1,-2,-1,-1,-1,-1,-1,-1,-1,-1,-1,-2, 0, 0,-2,-1,-1,-1,-1,-1,-4},
+  {-4,-4,-4,-4,-4,-4,-4,-4,-4,-4,-4,-4,-4,-4,-4,-4,-4,-4,-4,-4,-4,-4,-4, 1}
+};
+
+// the residue code of each character
+static unsigned char residueCode[256];
+
+/*
+ * A set of sequences read from a FASTA file.
+ */
+typedef struct
+{
+    int count;
+    char **names;
+    char **residues;
+    int *lengths;
+} SequenceSet;
+
+/*
+ * An alignment of some of the sequences of a family: rows[k] is the
+ * aligned sequence (with '-' for gaps) of sequence members[k].
+ */
+typedef struct
+{
+    int count;
+    int *members;
+    char **rows;
+    int length;
+} Profile;
+
+// the states of the dynamic programming for aligning two profiles:
+// a column of both, a column of the first against a gap, and a column of
+// the second against a gap
+#define STATE_MATCH 0
+#define STATE_GAP_IN_SECOND 1
+#define STATE_GAP_IN_FIRST 2
+
+/*
+ * What the threads share: the families to be aligned, and the next one
+ * to be taken.
+ */
+typedef struct
+{
+    char *familyDir;
+    char *resultsDir;
+    char **files;
+    int fileCount;
+    int next;
+    pthread_mutex_t lock;
+} WorkQueue;
+
+/*
+ * Called upon a fatal error
+ */
+void fatal(char *message)
+{
+    fprintf(stderr, "%s\n", message);
+    exit(-1);
+}
+
+void usageMessage(void)
+{
+    fprintf(stderr,
+      "Usage: familyAlign [-threads count] protein-family-dir\n");
+    exit(1);
+}
+
+void *allocate(size_t size)
+{
+    void *p = malloc(size);
+    if (p == NULL) fatal("malloc failed");
+    return p;
+}
+
+/*
+ * Allocate memory aligned for vectors.
+ */
+void *allocateVectors(size_t count)
+{
+    void *p;
+    if (posix_memalign(&p, sizeof(VectorInt), count * sizeof(VectorInt)) != 0)
+    {
+        fatal("posix_memalign failed");
+    }
+    return p;
+}
+
+void initResidueCodes(void)
+{
+    int i;
+
+    for (i = 0; i < 256; i++) residueCode[i] = CODE_X;
+    for (i = 0; residueLetters[i] != 0; i++)
+    {
+        residueCode[(int) residueLetters[i]] = i;
+        residueCode[tolower(residueLetters[i])] = i;
+    }
+}
+
+/*
+ * Read all the sequences in a FASTA file.
+ */
+void readSequences(const char *filename, SequenceSet *set)
+{
+    FILE *fp = fopen(filename, "r");
+    if (fp == NULL)
+    {
+        fprintf(stderr, "cannot open input (%s)\n", filename);
+        exit(EXIT_FAILURE);
+    }
+
+    int allocCount = 64;
+    set->count = 0;
+    set->names = allocate(sizeof(char *) * allocCount);
+    set->residues = allocate(sizeof(char *) * allocCount);
+    set->lengths = allocate(sizeof(int) * allocCount);
+
+    int seqAlloc = 0;
+    char *line = NULL;
+    size_t lineAlloc = 0;
+    ssize_t n;
+    while ((n = getline(&line, &lineAlloc, fp)) != -1)
+    {
+        if (line[0] == '>')
+        {
+            if (set->count == allocCount)
+            {
+                allocCount *= 2;
+                set->names = realloc(set->names, sizeof(char *) * allocCount);
+                set->residues = realloc(set->residues,
+                  sizeof(char *) * allocCount);
+                set->lengths = realloc(set->lengths, sizeof(int) * allocCount);
+                if (set->names == NULL || set->residues == NULL ||
+                  set->lengths == NULL)
+                {
+                    fatal("readSequences: realloc failed");
+                }
+            }
+
+            // the name is everything up to the first white space
+            char *start = line + 1;
+            while (*start == ' ' || *start == '\t') start++;
+            int len = strcspn(start, " \t\r\n");
+            set->names[set->count] = strndup(start, len);
+
+            seqAlloc = 1024;
+            set->residues[set->count] = allocate(seqAlloc);
+            set->residues[set->count][0] = 0;
+            set->lengths[set->count] = 0;
+            set->count += 1;
+        }
+        else
+        {
+            if (set->count == 0)
+            {
+                fprintf(stderr, "%s does not start with a FASTA header\n",
+                  filename);
+                exit(EXIT_FAILURE);
+            }
+            int s = set->count - 1;
+            int i;
+            for (i = 0; i < n; i++)
+            {
+                if (isspace((unsigned char) line[i])) continue;
+                if (set->lengths[s] + 2 > seqAlloc)
+                {
+                    seqAlloc *= 2;
+                    set->residues[s] = realloc(set->residues[s], seqAlloc);
+                    if (set->residues[s] == NULL)
+                    {
+                        fatal("readSequences: realloc failed");
+                    }
+                }
+                set->residues[s][set->lengths[s]] =
+                  toupper((unsigned char) line[i]);
+                set->lengths[s] += 1;
+            }
+            set->residues[s][set->lengths[s]] = 0;
+        }
+    }
+    free(line);
+    fclose(fp);
+}
+
+void freeSequences(SequenceSet *set)
+{
+    int i;
+    for (i = 0; i < set->count; i++)
+    {
+        free(set->names[i]);
+        free(set->residues[i]);
+    }
+    free(set->names);
+    free(set->residues);
+    free(set->lengths);
+}
+
+// every lane set to x
+#define SPLAT(x) ((VectorInt) {} + (x))
+
+// a where the mask is set, b elsewhere
+#define BLEND(mask, a, b) (((mask) & (a)) | (~(mask) & (b)))
+
+/*
+ * Compute the distances from sequence q to the sequences in subjects[],
+ * at most LANES of them, from global alignments of q with each. The
+ * alignments are done together, one in each lane of the vectors, and
+ * along with the score each cell carries the number of identities and of
+ * aligned residue pairs on its best path, in vectors of their own.
+ */
+void pairwiseDistances(SequenceSet *set, int q, int *subjects, int count,
+  double *distances)
+{
+    int maxLength = 0;
+    int l;
+    for (l = 0; l < count; l++)
+    {
+        if (set->lengths[subjects[l]] > maxLength)
+        {
+            maxLength = set->lengths[subjects[l]];
+        }
+    }
+    int width = maxLength + 1;
+
+    // the score and the identity count (0 or 1) of each query residue code
+    // against each column of the subjects
+    VectorInt *scores = allocateVectors((size_t) RESIDUE_CODES * width);
+    VectorInt *identities = allocateVectors((size_t) RESIDUE_CODES * width);
+    int code;
+    int j;
+    for (j = 1; j < width; j++)
+    {
+        int subjectCode[LANES];
+        for (l = 0; l < LANES; l++)
+        {
+            subjectCode[l] = CODE_X;
+            if (l < count && j <= set->lengths[subjects[l]])
+            {
+                subjectCode[l] = residueCode[(unsigned char)
+                  set->residues[subjects[l]][j-1]];
+            }
+        }
+        for (code = 0; code < RESIDUE_CODES; code++)
+        {
+            VectorInt s;
+            VectorInt c;
+            for (l = 0; l < LANES; l++)
+            {
+                s[l] = blosum62[code][subjectCode[l]];
+                c[l] = (code == subjectCode[l]);
+            }
+            scores[code * width + j] = s;
+            identities[code * width + j] = c;
+        }
+    }
+
+    // score, identities and pairs of the best path ending in each column
+    // of the previous row, and of the best ending in a gap in the subject
+    VectorInt *h = allocateVectors(width);
+    VectorInt *hIdent = allocateVectors(width);
+    VectorInt *hPairs = allocateVectors(width);
+    VectorInt *f = allocateVectors(width);
+    VectorInt *fIdent = allocateVectors(width);
+    VectorInt *fPairs = allocateVectors(width);
+    const VectorInt zero = SPLAT(0);
+    const VectorInt one = SPLAT(1);
+    const VectorInt open = SPLAT(GAP_OPEN + GAP_EXTEND);
+    const VectorInt extend = SPLAT(GAP_EXTEND);
+    const VectorInt minusInfinity = SPLAT(MINUS_INFINITY);
+
+    // the first row: leading gaps in the query
+    for (j = 0; j < width; j++)
+    {
+        h[j] = SPLAT(-GAP_EXTEND * j);
+        hIdent[j] = zero;
+        hPairs[j] = zero;
+        f[j] = minusInfinity;
+        fIdent[j] = zero;
+        fPairs[j] = zero;
+    }
+
+    const char *query = set->residues[q];
+    int m = set->lengths[q];
+
+    // best score (and its counts) of each lane, allowing trailing gaps in
+    // the subject at extension cost
+    int best[LANES];
+    int bestIdent[LANES];
+    int bestPairs[LANES];
+    for (l = 0; l < count; l++)
+    {
+        int end = set->lengths[subjects[l]];
+        best[l] = h[end][l] - GAP_EXTEND * m;
+        bestIdent[l] = 0;
+        bestPairs[l] = 0;
+    }
+
+    int i;
+    for (i = 1; i <= m; i++)
+    {
+        code = residueCode[(unsigned char) query[i-1]];
+        VectorInt *rowScores = scores + code * width;
+        VectorInt *rowIdent = identities + code * width;
+
+        VectorInt diagonal = h[0];
+        VectorInt diagonalIdent = hIdent[0];
+        VectorInt diagonalPairs = hPairs[0];
+        h[0] = SPLAT(-GAP_EXTEND * i);
+        hIdent[0] = zero;
+        hPairs[0] = zero;
+        VectorInt e = minusInfinity;
+        VectorInt eIdent = zero;
+        VectorInt ePairs = zero;
+
+        for (j = 1; j < width; j++)
+        {
+            // gap in the subject (coming down from the row above)
+            VectorInt fromH = h[j] - open;
+            VectorInt fromF = f[j] - extend;
+            VectorInt mask = fromH >= fromF;
+            f[j] = BLEND(mask, fromH, fromF);
+            fIdent[j] = BLEND(mask, hIdent[j], fIdent[j]);
+            fPairs[j] = BLEND(mask, hPairs[j], fPairs[j]);
+
+            // gap in the query (coming across from the left)
+            fromH = h[j-1] - open;
+            VectorInt fromE = e - extend;
+            mask = fromH >= fromE;
+            e = BLEND(mask, fromH, fromE);
+            eIdent = BLEND(mask, hIdent[j-1], eIdent);
+            ePairs = BLEND(mask, hPairs[j-1], ePairs);
+
+            // residue against residue
+            VectorInt score = diagonal + rowScores[j];
+            VectorInt scoreIdent = diagonalIdent + rowIdent[j];
+            VectorInt scorePairs = diagonalPairs + one;
+            diagonal = h[j];
+            diagonalIdent = hIdent[j];
+            diagonalPairs = hPairs[j];
+
+            mask = f[j] > score;
+            score = BLEND(mask, f[j], score);
+            scoreIdent = BLEND(mask, fIdent[j], scoreIdent);
+            scorePairs = BLEND(mask, fPairs[j], scorePairs);
+            mask = e > score;
+            h[j] = BLEND(mask, e, score);
+            hIdent[j] = BLEND(mask, eIdent, scoreIdent);
+            hPairs[j] = BLEND(mask, ePairs, scorePairs);
+        }
+
+        // trailing gaps in the subject
+        for (l = 0; l < count; l++)
+        {
+            int end = set->lengths[subjects[l]];
+            int score = h[end][l] - GAP_EXTEND * (m - i);
+            if (score > best[l])
+            {
+                best[l] = score;
+                bestIdent[l] = hIdent[end][l];
+                bestPairs[l] = hPairs[end][l];
+            }
+        }
+    }
+
+    // trailing gaps in the query
+    for (l = 0; l < count; l++)
+    {
+        int end = set->lengths[subjects[l]];
+        for (j = 0; j < end; j++)
+        {
+            int score = h[j][l] - GAP_EXTEND * (end - j);
+            if (score > best[l])
+            {
+                best[l] = score;
+                bestIdent[l] = hIdent[j][l];
+                bestPairs[l] = hPairs[j][l];
+            }
+        }
+
+        distances[l] = (bestPairs[l] == 0) ? 1.0 :
+          1.0 - (double) bestIdent[l] / bestPairs[l];
+    }
+
+    free(scores);
+    free(identities);
+    free(h);
+    free(hIdent);
+    free(hPairs);
+    free(f);
+    free(fIdent);
+    free(fPairs);
+}
+
+/*
+ * Fill in the distance matrix of a family.
+ */
+void distanceMatrix(SequenceSet *set, double **distance)
+{
+    int subjects[LANES];
+    double distances[LANES];
+    int i;
+    int j;
+    int l;
+
+    for (i = 0; i < set->count; i++)
+    {
+        distance[i][i] = 0;
+        for (j = i + 1; j < set->count; j += LANES)
+        {
+            int count = 0;
+            while (count < LANES && j + count < set->count)
+            {
+                subjects[count] = j + count;
+                count += 1;
+            }
+            pairwiseDistances(set, i, subjects, count, distances);
+            for (l = 0; l < count; l++)
+            {
+                distance[i][j+l] = distances[l];
+                distance[j+l][i] = distances[l];
+            }
+        }
+    }
+}
+
+/*
+ * The largest of the scores of the three states, and which state it is
+ * (the first of them, if there is a tie).
+ */
+static inline long long best3(long long match, long long gapInSecond,
+  long long gapInFirst, int *state)
+{
+    long long best = match;
+    *state = STATE_MATCH;
+    if (gapInSecond > best)
+    {
+        best = gapInSecond;
+        *state = STATE_GAP_IN_SECOND;
+    }
+    if (gapInFirst > best)
+    {
+        best = gapInFirst;
+        *state = STATE_GAP_IN_FIRST;
+    }
+    return best;
+}
+
+/*
+ * Align two profiles, putting the result into a new profile whose members
+ * are those of the first followed by those of the second.
+ */
+void alignProfiles(Profile *a, Profile *b, Profile *result)
+{
+    int m = a->length;
+    int n = b->length;
+    int i;
+    int j;
+    int k;
+    int x;
+
+    // the residues of each column of a, with their counts
+    unsigned char *aCodes = allocate((size_t) (m + 1) * a->count);
+    int *aWeights = allocate(sizeof(int) * (m + 1) * a->count);
+    int *aNumber = allocate(sizeof(int) * (m + 1));
+    for (i = 0; i < m; i++)
+    {
+        aNumber[i] = 0;
+        for (k = 0; k < a->count; k++)
+        {
+            char c = a->rows[k][i];
+            if (c == '-') continue;
+            int code = residueCode[(unsigned char) c];
+            int found = 0;
+            for (x = 0; x < aNumber[i]; x++)
+            {
+                if (aCodes[i * a->count + x] == code)
+                {
+                    aWeights[i * a->count + x] += 1;
+                    found = 1;
+                    break;
+                }
+            }
+            if (!found)
+            {
+                aCodes[i * a->count + aNumber[i]] = code;
+                aWeights[i * a->count + aNumber[i]] = 1;
+                aNumber[i] += 1;
+            }
+        }
+    }
+
+    // the total score of each residue against each column of b
+    int *bScores = allocate(sizeof(int) * (n + 1) * RESIDUE_CODES);
+    for (x = 0; x < RESIDUE_CODES; x++)
+    {
+        int *scores = bScores + x * (n + 1);
+        for (j = 0; j < n; j++)
+        {
+            scores[j] = 0;
+            for (k = 0; k < b->count; k++)
+            {
+                char c = b->rows[k][j];
+                if (c == '-') continue;
+                scores[j] += blosum62[x][residueCode[(unsigned char) c]];
+            }
+        }
+    }
+
+    // the scores of the three states for the previous and current rows,
+    // and for each cell, the state each state came from (two bits each).
+    // The scores are kept as totals over all the pairs of sequences (one
+    // from a, one from b) rather than averages, so the gap costs are
+    // scaled by the number of pairs, and the arithmetic is exact.
+    long long *matchPrevious = allocate(sizeof(long long) * (n + 1));
+    long long *gapInSecondPrevious = allocate(sizeof(long long) * (n + 1));
+    long long *gapInFirstPrevious = allocate(sizeof(long long) * (n + 1));
+    long long *match = allocate(sizeof(long long) * (n + 1));
+    long long *gapInSecond = allocate(sizeof(long long) * (n + 1));
+    long long *gapInFirst = allocate(sizeof(long long) * (n + 1));
+    unsigned char *trace = allocate((size_t) (m + 1) * (n + 1));
+
+    // the score of the current column of a against each column of b
+    long long *pairScores = allocate(sizeof(long long) * (n + 1));
+
+    const long long pairs = (long long) a->count * b->count;
+    const long long minusInfinity = LLONG_MIN / 2;
+    const long long open = (GAP_OPEN + GAP_EXTEND) * pairs;
+    const long long extend = GAP_EXTEND * pairs;
+
+    for (i = 0; i <= m; i++)
+    {
+        unsigned char *rowTrace = trace + (size_t) i * (n + 1);
+        int fromMatch;
+        int fromGapInSecond;
+        int fromGapInFirst;
+
+        // a column of b against a gap only costs the extension when a is
+        // at an end
+        long long gapOpenInFirst = (i == 0 || i == m) ? extend : open;
+
+        if (i == 0)
+        {
+            match[0] = 0;
+            gapInSecond[0] = minusInfinity;
+            gapInFirst[0] = minusInfinity;
+            rowTrace[0] = 0;
+            for (j = 1; j <= n; j++)
+            {
+                match[j] = minusInfinity;
+                gapInSecond[j] = minusInfinity;
+                gapInFirst[j] = best3(match[j-1] - gapOpenInFirst,
+                  gapInSecond[j-1] - gapOpenInFirst, gapInFirst[j-1] - extend,
+                  &fromGapInFirst);
+                rowTrace[j] = fromGapInFirst << 4;
+            }
+        }
+        else
+        {
+            for (j = 0; j < n; j++) pairScores[j] = 0;
+            for (x = 0; x < aNumber[i-1]; x++)
+            {
+                int weight = aWeights[(i - 1) * a->count + x];
+                int code = aCodes[(i - 1) * a->count + x];
+                int *scores = bScores + code * (n + 1);
+                for (j = 0; j < n; j++) pairScores[j] += weight * scores[j];
+            }
+
+            // a column of a against a leading gap
+            match[0] = minusInfinity;
+            gapInSecond[0] = best3(matchPrevious[0] - extend,
+              gapInSecondPrevious[0] - extend, gapInFirstPrevious[0] - extend,
+              &fromGapInSecond);
+            gapInFirst[0] = minusInfinity;
+            rowTrace[0] = fromGapInSecond << 2;
+
+            for (j = 1; j <= n; j++)
+            {
+                // a column of a against a gap only costs the extension
+                // when b is at its end
+                long long gapOpenInSecond = (j == n) ? extend : open;
+
+                match[j] = best3(matchPrevious[j-1], gapInSecondPrevious[j-1],
+                  gapInFirstPrevious[j-1], &fromMatch) + pairScores[j-1];
+                gapInSecond[j] = best3(matchPrevious[j] - gapOpenInSecond,
+                  gapInSecondPrevious[j] - extend,
+                  gapInFirstPrevious[j] - gapOpenInSecond, &fromGapInSecond);
+                gapInFirst[j] = best3(match[j-1] - gapOpenInFirst,
+                  gapInSecond[j-1] - gapOpenInFirst, gapInFirst[j-1] - extend,
+                  &fromGapInFirst);
+                rowTrace[j] =
+                  fromMatch | (fromGapInSecond << 2) | (fromGapInFirst << 4);
+            }
+        }
+
+        long long *swap = matchPrevious;
+        matchPrevious = match;
+        match = swap;
+        swap = gapInSecondPrevious;
+        gapInSecondPrevious = gapInSecond;
+        gapInSecond = swap;
+        swap = gapInFirstPrevious;
+        gapInFirstPrevious = gapInFirst;
+        gapInFirst = swap;
+    }
+
+    // trace back from the best state of the last cell, recording for each
+    // column of the result which column of a and of b it holds (-1 for a
+    // gap), in reverse order
+    int state;
+    best3(matchPrevious[n], gapInSecondPrevious[n], gapInFirstPrevious[n],
+      &state);
+
+    int *aColumn = allocate(sizeof(int) * (m + n + 1));
+    int *bColumn = allocate(sizeof(int) * (m + n + 1));
+    int length = 0;
+    i = m;
+    j = n;
+    while (i > 0 || j > 0)
+    {
+        unsigned char t = trace[(size_t) i * (n + 1) + j];
+        if (state == STATE_MATCH)
+        {
+            aColumn[length] = --i;
+            bColumn[length] = --j;
+            state = t & 3;
+        }
+        else if (state == STATE_GAP_IN_SECOND)
+        {
+            aColumn[length] = --i;
+            bColumn[length] = -1;
+            state = (t >> 2) & 3;
+        }
+        else
+        {
+            aColumn[length] = -1;
+            bColumn[length] = --j;
+            state = (t >> 4) & 3;
+        }
+        length += 1;
+    }
+
+    result->count = a->count + b->count;
+    result->members = allocate(sizeof(int) * result->count);
+    result->rows = allocate(sizeof(char *) * result->count);
+    result->length = length;
+    for (k = 0; k < result->count; k++)
+    {
+        Profile *from = (k < a->count) ? a : b;
+        int fromRow = (k < a->count) ? k : k - a->count;
+        int *columns = (k < a->count) ? aColumn : bColumn;
+        char *row = allocate(length + 1);
+        int c;
+        for (c = 0; c < length; c++)
+        {
+            int column = columns[length - 1 - c];
+            row[c] = (column < 0) ? '-' : from->rows[fromRow][column];
+        }
+        row[length] = 0;
+        result->members[k] = from->members[fromRow];
+        result->rows[k] = row;
+    }
+
+    free(aCodes);
+    free(aWeights);
+    free(aNumber);
+    free(bScores);
+    free(matchPrevious);
+    free(gapInSecondPrevious);
+    free(gapInFirstPrevious);
+    free(match);
+    free(gapInSecond);
+    free(gapInFirst);
+    free(trace);
+    free(pairScores);
+    free(aColumn);
+    free(bColumn);
+}
+
+void freeProfile(Profile *p)
+{
+    int k;
+    for (k = 0; k < p->count; k++) free(p->rows[k]);
+    free(p->rows);
+    free(p->members);
+}
+
+/*
+ * The guide tree of a family: an unrooted binary tree built by neighbor
+ * joining, whose leaves 0..count-1 are the sequences. Each node has up
+ * to three neighbors, with the lengths of the branches to them.
+ */
+typedef struct
+{
+    int nodeCount;
+    int (*neighbors)[3];
+    double (*lengths)[3];
+    int *degree;
+} GuideTree;
+
+/*
+ * Add a branch between nodes u and v.
+ */
+void addBranch(GuideTree *tree, int u, int v, double length)
+{
+    // neighbor joining can give negative lengths, which clustalw sets to 0
+    if (length < 0) length = 0;
+    tree->neighbors[u][tree->degree[u]] = v;
+    tree->lengths[u][tree->degree[u]] = length;
+    tree->degree[u] += 1;
+    tree->neighbors[v][tree->degree[v]] = u;
+    tree->lengths[v][tree->degree[v]] = length;
+    tree->degree[v] += 1;
+}
+
+/*
+ * Build the guide tree of count (at least 3) sequences from their distance
+ * matrix by neighbor joining. Ties are broken by the order of the family
+ * file.
+ */
+void neighborJoining(double **distance, int count, GuideTree *tree)
+{
+    int maxNodes = 2 * count - 2;
+    int i;
+    int j;
+    int k;
+
+    tree->nodeCount = count;
+    tree->neighbors = allocate(sizeof(int [3]) * maxNodes);
+    tree->lengths = allocate(sizeof(double [3]) * maxNodes);
+    tree->degree = allocate(sizeof(int) * maxNodes);
+    memset(tree->degree, 0, sizeof(int) * maxNodes);
+
+    // the distances between the nodes not yet joined, which are kept in
+    // the first r slots, node[] giving the node in each slot
+    double **d = allocate(sizeof(double *) * count);
+    int *node = allocate(sizeof(int) * count);
+    double *sum = allocate(sizeof(double) * count);
+    for (i = 0; i < count; i++)
+    {
+        d[i] = allocate(sizeof(double) * count);
+        memcpy(d[i], distance[i], sizeof(double) * count);
+        node[i] = i;
+    }
+
+    int r;
+    for (r = count; r > 3; r--)
+    {
+        for (i = 0; i < r; i++)
+        {
+            sum[i] = 0;
+            for (k = 0; k < r; k++) sum[i] += d[i][k];
+        }
+
+        // join the pair that most reduces the total branch length
+        int bestI = 0;
+        int bestJ = 1;
+        double bestQ = 0;
+        for (i = 0; i < r; i++)
+        {
+            for (j = i + 1; j < r; j++)
+            {
+                double q = (r - 2) * d[i][j] - sum[i] - sum[j];
+                if ((i == 0 && j == 1) || q < bestQ)
+                {
+                    bestQ = q;
+                    bestI = i;
+                    bestJ = j;
+                }
+            }
+        }
+
+        int u = tree->nodeCount++;
+        double lengthI = d[bestI][bestJ] / 2 +
+          (sum[bestI] - sum[bestJ]) / (2 * (r - 2));
+        addBranch(tree, u, node[bestI], lengthI);
+        addBranch(tree, u, node[bestJ], d[bestI][bestJ] - lengthI);
+
+        // the new node takes the slot of bestI, and the last slot moves
+        // into that of bestJ
+        for (k = 0; k < r; k++)
+        {
+            if (k == bestI || k == bestJ) continue;
+            double dk = (d[bestI][k] + d[bestJ][k] - d[bestI][bestJ]) / 2;
+            d[bestI][k] = dk;
+            d[k][bestI] = dk;
+        }
+        d[bestI][bestI] = 0;
+        node[bestI] = u;
+        for (k = 0; k < r; k++)
+        {
+            d[bestJ][k] = d[r-1][k];
+            d[k][bestJ] = d[k][r-1];
+        }
+        d[bestJ][bestJ] = 0;
+        node[bestJ] = node[r-1];
+    }
+
+    // the last three nodes are joined to a node in the middle
+    int u = tree->nodeCount++;
+    addBranch(tree, u, node[0], (d[0][1] + d[0][2] - d[1][2]) / 2);
+    addBranch(tree, u, node[1], (d[0][1] + d[1][2] - d[0][2]) / 2);
+    addBranch(tree, u, node[2], (d[0][2] + d[1][2] - d[0][1]) / 2);
+
+    for (i = 0; i < count; i++) free(d[i]);
+    free(d);
+    free(node);
+    free(sum);
+}
+
+void freeGuideTree(GuideTree *tree)
+{
+    free(tree->neighbors);
+    free(tree->lengths);
+    free(tree->degree);
+}
+
+/*
+ * Sum the distances from node u to the leaves on its side of the branch to
+ * parent, and count those leaves.
+ */
+void leafDistances(GuideTree *tree, int u, int parent, double *total,
+  int *leaves)
+{
+    *total = 0;
+    *leaves = 0;
+    if (tree->degree[u] == 1)
+    {
+        *leaves = 1;
+        return;
+    }
+    int k;
+    for (k = 0; k < tree->degree[u]; k++)
+    {
+        int v = tree->neighbors[u][k];
+        if (v == parent) continue;
+        double subtotal;
+        int subleaves;
+        leafDistances(tree, v, u, &subtotal, &subleaves);
+        *total += subtotal + subleaves * tree->lengths[u][k];
+        *leaves += subleaves;
+    }
+}
+
+/*
+ * Find where to root the guide tree, as clustalw does: on the branch, and
+ * at the point of it, where the mean distances to the leaves on either
+ * side are closest to equal. Sets *rootU and *rootV to the ends of that
+ * branch.
+ */
+void findRoot(GuideTree *tree, int *rootU, int *rootV)
+{
+    double bestDifference = -1;
+    int u;
+    int k;
+    for (u = 0; u < tree->nodeCount; u++)
+    {
+        for (k = 0; k < tree->degree[u]; k++)
+        {
+            int v = tree->neighbors[u][k];
+            if (v < u) continue;
+            double length = tree->lengths[u][k];
+
+            double totalU, totalV;
+            int leavesU, leavesV;
+            leafDistances(tree, u, v, &totalU, &leavesU);
+            leafDistances(tree, v, u, &totalV, &leavesV);
+            double meanU = totalU / leavesU;
+            double meanV = totalV / leavesV;
+
+            // the root at x from u balances meanU + x and meanV + length - x
+            double x = (meanV - meanU + length) / 2;
+            if (x < 0) x = 0;
+            if (x > length) x = length;
+            double difference = meanU + x - (meanV + length - x);
+            if (difference < 0) difference = -difference;
+
+            if (bestDifference < 0 || difference < bestDifference)
+            {
+                bestDifference = difference;
+                *rootU = u;
+                *rootV = v;
+            }
+        }
+    }
+}
+
+/*
+ * The profile of sequence i on its own.
+ */
+void leafProfile(SequenceSet *set, int i, Profile *result)
+{
+    result->count = 1;
+    result->members = allocate(sizeof(int));
+    result->members[0] = i;
+    result->rows = allocate(sizeof(char *));
+    result->rows[0] = strdup(set->residues[i]);
+    result->length = set->lengths[i];
+}
+
+/*
+ * Align the sequences below node u of the guide tree rooted above it (on
+ * the side away from parent), aligning the profiles of the two subtrees
+ * of each node.
+ */
+void alignSubtree(SequenceSet *set, GuideTree *tree, int u, int parent,
+  Profile *result)
+{
+    if (u < set->count)
+    {
+        leafProfile(set, u, result);
+        return;
+    }
+
+    Profile children[2];
+    int c = 0;
+    int k;
+    for (k = 0; k < tree->degree[u]; k++)
+    {
+        if (tree->neighbors[u][k] == parent) continue;
+        alignSubtree(set, tree, tree->neighbors[u][k], u, &children[c]);
+        c += 1;
+    }
+    alignProfiles(&children[0], &children[1], result);
+    freeProfile(&children[0]);
+    freeProfile(&children[1]);
+}
+
+/*
+ * Align a family: build the guide tree by neighbor joining, root it, and
+ * align the profiles of the two subtrees of each node from the leaves up.
+ * Returns the profile of the whole family.
+ */
+void alignFamily(SequenceSet *set, Profile *result)
+{
+    int count = set->count;
+    int i;
+
+    // neighbor joining needs at least three sequences
+    if (count < 3)
+    {
+        leafProfile(set, 0, result);
+        if (count == 2)
+        {
+            Profile a = *result;
+            Profile b;
+            leafProfile(set, 1, &b);
+            alignProfiles(&a, &b, result);
+            freeProfile(&a);
+            freeProfile(&b);
+        }
+        return;
+    }
+
+    double **distance = allocate(sizeof(double *) * count);
+    for (i = 0; i < count; i++)
+    {
+        distance[i] = allocate(sizeof(double) * count);
+    }
+    distanceMatrix(set, distance);
+
+    GuideTree tree;
+    neighborJoining(distance, count, &tree);
+
+    int rootU;
+    int rootV;
+    findRoot(&tree, &rootU, &rootV);
+
+    Profile a;
+    Profile b;
+    alignSubtree(set, &tree, rootU, rootV, &a);
+    alignSubtree(set, &tree, rootV, rootU, &b);
+    alignProfiles(&a, &b, result);
+    freeProfile(&a);
+    freeProfile(&b);
+
+    freeGuideTree(&tree);
+    for (i = 0; i < count; i++) free(distance[i]);
+    free(distance);
+}
+
+/*
+ * Write the aligned family in the order of the family file.
+ */
+void writeAlignment(const char *filename, SequenceSet *set, Profile *p)
+{
+    FILE *fp = fopen(filename, "w");
+    if (fp == NULL)
+    {
+        fprintf(stderr, "cannot open output (%s)\n", filename);
+        exit(EXIT_FAILURE);
+    }
+
+    int *rowOf = allocate(sizeof(int) * (set->count + 1));
+    int k;
+    for (k = 0; k < p->count; k++) rowOf[p->members[k]] = k;
+
+    int s;
+    for (s = 0; s < set->count; s++)
+    {
+        // clustalw replaces colons in names by underscores
+        char *c;
+        for (c = set->names[s]; *c != 0; c++)
+        {
+            if (*c == ':') *c = '_';
+        }
+        fprintf(fp, ">%s\n", set->names[s]);
+
+        const char *row = p->rows[rowOf[s]];
+        int i;
+        for (i = 0; i < p->length; i += LINE_LENGTH)
+        {
+            fprintf(fp, "%.*s\n", LINE_LENGTH, row + i);
+        }
+    }
+
+    free(rowOf);
+    if (fclose(fp) != 0)
+    {
+        fprintf(stderr, "cannot write output (%s)\n", filename);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*
+ * Align one family file.
+ */
+void processFamily(WorkQueue *queue, const char *file)
+{
+    // the output is named by the family number in the file name
+    const char *digits = file;
+    while (*digits != 0 && !isdigit((unsigned char) *digits)) digits++;
+    int numberLength = strspn(digits, "0123456789");
+    if (numberLength == 0 || digits[numberLength] != '.')
+    {
+        fprintf(stderr, "cannot parse the input file name (%s)\n", file);
+        exit(EXIT_FAILURE);
+    }
+
+    char inFile[PATH_MAX];
+    char outFile[PATH_MAX];
+    snprintf(inFile, sizeof(inFile), "%s/%s", queue->familyDir, file);
+    snprintf(outFile, sizeof(outFile), "%s/%.*s.fasta", queue->resultsDir,
+      numberLength, digits);
+
+    SequenceSet set;
+    readSequences(inFile, &set);
+
+    Profile p;
+    p.count = 0;
+    p.length = 0;
+    if (set.count > 0)
+    {
+        alignFamily(&set, &p);
+    }
+    writeAlignment(outFile, &set, &p);
+
+    if (set.count > 0) freeProfile(&p);
+    freeSequences(&set);
+}
+
+/*
+ * Thread body: align families until there are none left.
+ */
+void *alignFamilies(void *arg)
+{
+    WorkQueue *queue = arg;
+
+    while (1)
+    {
+        pthread_mutex_lock(&queue->lock);
+        int next = queue->next;
+        queue->next += 1;
+        pthread_mutex_unlock(&queue->lock);
+
+        if (next >= queue->fileCount) break;
+        processFamily(queue, queue->files[next]);
+    }
+
+    return NULL;
+}
+
+int compareNames(const void *a, const void *b)
+{
+    return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+int main(int argc, char **argv)
+{
+    int threadCount = DEFAULT_THREADS;
+
+    int i = 1;
+    while (i < argc && argv[i][0] == '-')
+    {
+        if (!strcmp(argv[i], "-threads") && i + 1 < argc)
+        {
+            threadCount = atoi(argv[i+1]);
+            if (threadCount < 1) usageMessage();
+            i += 2;
+        }
+        else
+        {
+            usageMessage();
+        }
+    }
+    if (argc - i != 1) usageMessage();
+
+    initResidueCodes();
+
+    WorkQueue queue;
+    queue.familyDir = strdup(argv[i]);
+    int len = strlen(queue.familyDir);
+    if (len > 1 && queue.familyDir[len-1] == '/')
+    {
+        queue.familyDir[len-1] = 0;
+    }
+
+    // get all the family names
+    DIR *dir = opendir(queue.familyDir);
+    if (dir == NULL)
+    {
+        fprintf(stderr, "cannot open %s\n", queue.familyDir);
+        exit(EXIT_FAILURE);
+    }
+    int allocCount = 1024;
+    queue.files = allocate(sizeof(char *) * allocCount);
+    queue.fileCount = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        if (entry->d_name[0] == '.') continue;
+        if (queue.fileCount == allocCount)
+        {
+            allocCount *= 2;
+            queue.files = realloc(queue.files, sizeof(char *) * allocCount);
+            if (queue.files == NULL) fatal("main: realloc failed");
+        }
+        queue.files[queue.fileCount] = strdup(entry->d_name);
+        queue.fileCount += 1;
+    }
+    closedir(dir);
+    qsort(queue.files, queue.fileCount, sizeof(char *), compareNames);
+
+    // create a directory for results
+    queue.resultsDir = allocate(strlen(queue.familyDir) + 9);
+    sprintf(queue.resultsDir, "%s-aligned", queue.familyDir);
+    if (mkdir(queue.resultsDir, 0755) != 0)
+    {
+        fatal("Could not create directory");
+    }
+
+    queue.next = 0;
+    pthread_mutex_init(&queue.lock, NULL);
+
+    pthread_t *tids = allocate(sizeof(pthread_t) * threadCount);
+    int t;
+    for (t = 0; t < threadCount; t++)
+    {
+        if (pthread_create(&tids[t], NULL, alignFamilies, &queue) != 0)
+        {
+            fatal("main: pthread_create failed");
+        }
+    }
+    for (t = 0; t < threadCount; t++)
+    {
+        pthread_join(tids[t], NULL);
+    }
+
+    return 0;
+}
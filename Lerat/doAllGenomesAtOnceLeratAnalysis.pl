@@ -39,15 +39,46 @@
 # Modified by pjh in June 2010 by request of Nancy Garnhart to make the output
 # files more amenable for further processing.
 #
+# Modified by agent in October 2026 to take optional first arguments,
+# "-mpi <processes> <machinefile>", which find the homolog families with
+# mpiHomologFamilies, run by mpiexec on that many processes on the machines
+# of the MPI machine file, rather than findHomologFamilies.pl. The families
+# are the same either way; this is for collections whose hits are too many
+# for one node's memory.
+#
 
 use strict;
 use warnings;
 use Cwd;
 use Sys::Hostname;
 
+my $mpiProcesses = 0;
+my $machinefile;
+if (@ARGV >= 3 && $ARGV[0] eq "-mpi")
+{
+  shift @ARGV;
+  $mpiProcesses = shift @ARGV;
+  $machinefile = shift @ARGV;
+  if ($mpiProcesses !~ /^\d+$/ || $mpiProcesses < 1)
+  {
+    die "-mpi must be followed by a number of processes and a " .
+      "machinefile\n";
+  }
+
+  # check the machinefile now, rather than after the hits are found
+  my $path = Cwd::abs_path($machinefile);
+  if (!defined($path) || ! -f $path)
+  {
+    die "cannot open machinefile provided for MPI ($machinefile)\n";
+  }
+  $machinefile = $path;
+}
+
 if (@ARGV < 6)
 {
-  die "Usage: doAllGenomesAtOnceLeratAnalysis.pl [-lerat | -evalue] " .
+  die "Usage: doAllGenomesAtOnceLeratAnalysis.pl " .
+    "[-mpi processes machinefile] " .
+    "[-lerat | -evalue] " .
     "threshold [-oneway | -reciprocal] blastDirectory prefix " .
     "<list of genome names>\n";
 }
@@ -206,14 +237,20 @@ else
 
 # find the homolog families
 print "Find the homolog families...\n";
+my $findFamilies = "findHomologFamilies.pl";
+if ($mpiProcesses > 0)
+{
+  $findFamilies = "mpiexec -n $mpiProcesses -f $machinefile " .
+    "mpiHomologFamilies";
+}
 if ($membership eq "-oneway")
 {
-  $exit = system "findHomologFamilies.pl $prefix.hits $membership " .
+  $exit = system "$findFamilies $prefix.hits $membership " .
                    "$prefix.family";
 }
 else
 {
-  $exit = system "findHomologFamilies.pl $prefix.hits $membership " .
+  $exit = system "$findFamilies $prefix.hits $membership " .
                    "$prefix.family $prefix.reverse";
 }
 if ($exit == 0)
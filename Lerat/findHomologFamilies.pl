@@ -2,6 +2,14 @@
 # $Id: findHomologFamilies.pl 6 2013-11-16 01:42:31Z pjh $
 #
 
+#
+# agent, October 2026
+# made the output depend only on the input files: the reciprocal hits of a
+# gene are now used in the order of the forward hits file (rather than in
+# Perl's hash order, which changes from run to run), and the genomes in the
+# csv file are in the order in which they first appear in the hits file.
+# mpiHomologFamilies, the MPI version of this script, produces the same
+# output files.
 #
 # Phil Hatcher, July 2013
 # modified to add an additional output file
@@ -69,8 +77,8 @@ if ($mode eq "-reciprocal")
 }
 
 # takes two space separated "lists" of genes and computes the intersection
-# of the two lists. input could be either undef or empty string indicating
-# the empty set.
+# of the two lists, in the order of the first list. input could be either
+# undef or empty string indicating the empty set.
 sub intersect
 {
   my $arg1 = $_[0];
@@ -104,11 +112,12 @@ sub intersect
     }
   
     @ret = ();
-    while ((my $key, my $value) = each %tmp)
+    foreach my $gene (@list1)
     {
-      if ($value == 1)
+      if ($tmp{$gene} == 1)
       {
-        push(@ret, $key);
+        push(@ret, $gene);
+        $tmp{$gene} = 2;
       }
     }
   }
@@ -123,7 +132,9 @@ my @family = ();
 my %familyHash = ();
 
 # hash to track genomes present in families
+# (and list of them in the order they were first seen)
 my %genomeHash = ();
+my @genomeList = ();
 
 # makes a new family
 #   only is called with two genes
@@ -213,6 +224,10 @@ while (my $line = <HITS>)
 
   # remember the genome
   my ($genomeName, $geneName) = split /\$/, $gene;
+  if (!defined($genomeHash{$genomeName}))
+  {
+    push @genomeList, $genomeName;
+  }
   $genomeHash{$genomeName} = $genomeName;
 
   my $hitsStr = join " ", @pieces;
@@ -275,7 +290,7 @@ open(FAMILY, ">", $outputFile) or
 open(CSV, ">", $outputFile2) or
   die "cannot open output ($outputFile2)\n";
 print CSV "family";
-foreach my $genomeName ( keys(%genomeHash) ) {
+foreach my $genomeName (@genomeList) {
   print CSV ",$genomeName";
 }
 print CSV "\n";
@@ -302,7 +317,7 @@ for (my $i = 0; $i < $familyCnt; $i += 1)
       print FAMILY " $gene";
     }
     print FAMILY "\n";
-    foreach my $genomeName ( keys(%genomeHash) ) {
+    foreach my $genomeName (@genomeList) {
       my $cnt = $countHash{$genomeName};
       if (!defined($cnt))
       {
@@ -0,0 +1,1700 @@
+/*
+ * $Id$
+ *
+ * agent, October 2026
+ *
+ * The MPI version of findHomologFamilies.pl, for collections of genomes
+ * whose high-quality hits do not fit in the memory of one node. It takes
+ * the same arguments and writes the same two output files (the families
+ * and the csv file of genes per genome in each family), which are
+ * identical to those written by findHomologFamilies.pl.
+ *
+ * Nothing is held by a single process except while writing the output.
+ * The genes are numbered by their line in the hits file, and each process
+ * reads a share of the lines of the input files and owns the genes of the
+ * lines it read. The work is done in these steps:
+ *   1. gene names are turned into numbers through a dictionary that is
+ *      partitioned across the processes by a hash of the name.
+ *   2. each process keeps the hits of the genes it owns that are also
+ *      in the gene's reverse hits (for -reciprocal), which are sent to it
+ *      by the process that read them.
+ *   3. the connected components of the graph of those hits are found by
+ *      label propagation: each gene's label starts as its number, the
+ *      smaller label of the two genes of a hit is given to both, and
+ *      labels are shortened by pointer jumping (a gene takes the label of
+ *      its label), until no label changes. Each gene then has the smallest
+ *      number in its component as its label.
+ *   4. the hits of each component are sent to the owner of its label,
+ *      which replays findHomologFamilies.pl on them, in the order in which
+ *      that script reads them, to get the order of the genes in the family
+ *      and the line of the hits file at which the family was created.
+ *      So each family, with its hits, must fit in the memory of one
+ *      process; a family with more than MAX_COMPONENT_EDGES hits is an
+ *      error (reported before the hits are sent).
+ *   5. the families are numbered as the script numbers them, by counting
+ *      the lines before their line at which a family was created (at most
+ *      one family is created per line, and a family might later be merged
+ *      into another).
+ *   6. the families are sent, in order, to process 0 to be written.
+ *
+ * Usage: mpiexec -n <processes> mpiHomologFamilies hitsInput -oneway output
+ *        mpiexec -n <processes> mpiHomologFamilies hitsInput -reciprocal
+ *          output reverseHitsInput
+ *
+ * This must be compiled with mpicc.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <mpi.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#define WRITER_PROCESS 0
+
+#define FAMILY_TAG 1
+
+// size of the batches of families sent to the writer
+#define BATCH_SIZE (1 << 20)
+
+// the most hits a component may have, since all of them are sent to one
+// process (the default is as many ComponentEdges as exchange can deliver)
+#ifndef MAX_COMPONENT_EDGES
+#define MAX_COMPONENT_EDGES (1LL << 26)
+#endif
+
+typedef long long GeneId;
+
+/*
+ * A growable array of bytes, used for the messages sent to each process.
+ */
+typedef struct
+{
+  char *data;
+  size_t length;
+  size_t alloc;
+} Buffer;
+
+/*
+ * The lines of an input file read by this process. Each line is a gene
+ * followed by the genes it hits (or, for the reverse hits file, that hit
+ * it).
+ */
+typedef struct
+{
+  char *text;              // the lines, with spaces and newlines now nulls
+  char **tokens;           // the genes on all the lines
+  long long *lineToken;    // first token of each line (lineCount+1 entries)
+  int lineCount;
+  long long firstLine;     // number (in the file) of the first line
+  long long totalLines;    // number of lines in the file
+  long long *lineStarts;   // number of the first line read by each process
+} LineBlock;
+
+/*
+ * A hit of the gene of a line (the gene's number is the line number), and
+ * its position among the hits on the line.
+ */
+typedef struct
+{
+  GeneId line;
+  GeneId hit;
+  int position;
+} Edge;
+
+/*
+ * A hit, tagged with the label of its component.
+ */
+typedef struct
+{
+  GeneId label;
+  GeneId line;
+  GeneId hit;
+  int position;
+} ComponentEdge;
+
+/*
+ * A family built by this process: the line at which it was created, and
+ * its genes in order.
+ */
+typedef struct
+{
+  GeneId line;
+  GeneId number;
+  int geneCount;
+  GeneId *genes;
+  char **names;
+} Family;
+
+/*
+ * An entry of a string hash table.
+ */
+typedef struct
+{
+  char *key;
+  GeneId value;
+} HashEntry;
+
+typedef struct
+{
+  HashEntry *entries;
+  size_t count;
+  size_t alloc;
+} HashTable;
+
+static int rank;
+static int size;
+
+/*
+ * Called upon a fatal error
+ */
+void fatal(char *message)
+{
+  fprintf(stderr, "%s\n", message);
+  MPI_Abort(MPI_COMM_WORLD, -1);
+  exit(-1);
+}
+
+void *allocate(size_t n)
+{
+  void *p = malloc(n == 0 ? 1 : n);
+  if (p == NULL) fatal("malloc failed");
+  return p;
+}
+
+void *reallocate(void *p, size_t n)
+{
+  p = realloc(p, n == 0 ? 1 : n);
+  if (p == NULL) fatal("realloc failed");
+  return p;
+}
+
+void bufferAppend(Buffer *b, const void *bytes, size_t n)
+{
+  if (b->length + n > b->alloc)
+  {
+    b->alloc = (b->length + n) * 2 + 1024;
+    b->data = reallocate(b->data, b->alloc);
+  }
+  memcpy(b->data + b->length, bytes, n);
+  b->length += n;
+}
+
+Buffer *newBuffers(void)
+{
+  Buffer *b = allocate(sizeof(Buffer) * size);
+  memset(b, 0, sizeof(Buffer) * size);
+  return b;
+}
+
+void freeBuffers(Buffer *b)
+{
+  int p;
+  for (p = 0; p < size; p++) free(b[p].data);
+  free(b);
+}
+
+/*
+ * Send the contents of out[p] to process p, for every process, and
+ * receive what every process sent to this one, in the order of the
+ * sending processes. The out buffers are emptied. Returns the bytes
+ * received; displs[p] is where the bytes from process p start, and
+ * displs[size] is the total.
+ */
+char *exchange(Buffer *out, size_t *displs)
+{
+  int *sendCounts = allocate(sizeof(int) * size);
+  int *sendDispls = allocate(sizeof(int) * size);
+  int *recvCounts = allocate(sizeof(int) * size);
+  int *recvDispls = allocate(sizeof(int) * size);
+  int p;
+
+  size_t total = 0;
+  for (p = 0; p < size; p++)
+  {
+    total += out[p].length;
+  }
+  if (total > INT_MAX)
+  {
+    fatal("exchange: too much data for one process (use more processes)");
+  }
+
+  char *sendData = allocate(total);
+  total = 0;
+  for (p = 0; p < size; p++)
+  {
+    memcpy(sendData + total, out[p].data, out[p].length);
+    sendCounts[p] = out[p].length;
+    sendDispls[p] = total;
+    total += out[p].length;
+    out[p].length = 0;
+  }
+
+  MPI_Alltoall(sendCounts, 1, MPI_INT, recvCounts, 1, MPI_INT,
+    MPI_COMM_WORLD);
+
+  total = 0;
+  for (p = 0; p < size; p++)
+  {
+    displs[p] = total;
+    recvDispls[p] = total;
+    total += recvCounts[p];
+    if (total > INT_MAX)
+    {
+      fatal("exchange: too much data for one process (use more processes)");
+    }
+  }
+  displs[size] = total;
+
+  char *recvData = allocate(total);
+  MPI_Alltoallv(sendData, sendCounts, sendDispls, MPI_BYTE,
+    recvData, recvCounts, recvDispls, MPI_BYTE, MPI_COMM_WORLD);
+
+  free(sendData);
+  free(sendCounts);
+  free(sendDispls);
+  free(recvCounts);
+  free(recvDispls);
+
+  return recvData;
+}
+
+/*
+ * FNV-1a hash of a string.
+ */
+unsigned long long hashString(const char *s)
+{
+  unsigned long long h = 14695981039346656037ULL;
+  while (*s != 0)
+  {
+    h ^= (unsigned char) *s++;
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+void hashInit(HashTable *t)
+{
+  t->count = 0;
+  t->alloc = 1024;
+  t->entries = allocate(sizeof(HashEntry) * t->alloc);
+  memset(t->entries, 0, sizeof(HashEntry) * t->alloc);
+}
+
+/*
+ * Find the entry for a key, which has a null key if the key is not in the
+ * table.
+ */
+HashEntry *hashFind(HashTable *t, const char *key)
+{
+  size_t i = hashString(key) & (t->alloc - 1);
+  while (t->entries[i].key != NULL && strcmp(t->entries[i].key, key) != 0)
+  {
+    i = (i + 1) & (t->alloc - 1);
+  }
+  return &t->entries[i];
+}
+
+/*
+ * Add a key that is not in the table. The key is not copied.
+ */
+void hashInsert(HashTable *t, char *key, GeneId value)
+{
+  if (2 * (t->count + 1) > t->alloc)
+  {
+    HashEntry *old = t->entries;
+    size_t oldAlloc = t->alloc;
+    size_t i;
+    t->alloc *= 2;
+    t->entries = allocate(sizeof(HashEntry) * t->alloc);
+    memset(t->entries, 0, sizeof(HashEntry) * t->alloc);
+    for (i = 0; i < oldAlloc; i++)
+    {
+      if (old[i].key != NULL) *hashFind(t, old[i].key) = old[i];
+    }
+    free(old);
+  }
+  HashEntry *e = hashFind(t, key);
+  e->key = key;
+  e->value = value;
+  t->count += 1;
+}
+
+/*
+ * Read this process's share of the lines of a file: the lines that start
+ * in its share of the bytes of the file. Then number the lines.
+ */
+void readLines(const char *filename, LineBlock *b)
+{
+  FILE *fp = fopen(filename, "r");
+  if (fp == NULL)
+  {
+    fprintf(stderr, "cannot open input (%s)\n", filename);
+    fatal("");
+  }
+  struct stat st;
+  if (fstat(fileno(fp), &st) != 0)
+  {
+    fprintf(stderr, "cannot stat input (%s)\n", filename);
+    fatal("");
+  }
+  off_t start = (off_t) ((double) st.st_size * rank / size);
+  off_t end = (off_t) ((double) st.st_size * (rank + 1) / size);
+  if (rank == size - 1) end = st.st_size;
+
+  char *line = NULL;
+  size_t lineAlloc = 0;
+  ssize_t n;
+
+  // a line that starts in the previous share belongs to that process
+  off_t position = start;
+  if (start > 0)
+  {
+    fseeko(fp, start - 1, SEEK_SET);
+    if (getc(fp) != '\n')
+    {
+      n = getline(&line, &lineAlloc, fp);
+      if (n > 0) position += n;
+    }
+  }
+
+  Buffer text = { NULL, 0, 0 };
+  while (position < end && (n = getline(&line, &lineAlloc, fp)) != -1)
+  {
+    bufferAppend(&text, line, n);
+    if (line[n-1] != '\n') bufferAppend(&text, "\n", 1);
+    position += n;
+  }
+  bufferAppend(&text, "", 1);
+  free(line);
+  fclose(fp);
+
+  // split the lines into tokens
+  size_t tokenAlloc = 1024;
+  size_t tokenCount = 0;
+  int lineAllocCount = 1024;
+  b->text = text.data;
+  b->tokens = allocate(sizeof(char *) * tokenAlloc);
+  b->lineToken = allocate(sizeof(long long) * (lineAllocCount + 1));
+  b->lineCount = 0;
+
+  char *p = b->text;
+  while (*p != 0)
+  {
+    if (b->lineCount == lineAllocCount)
+    {
+      lineAllocCount *= 2;
+      b->lineToken = reallocate(b->lineToken,
+        sizeof(long long) * (lineAllocCount + 1));
+    }
+    b->lineToken[b->lineCount] = tokenCount;
+    while (*p != '\n')
+    {
+      if (*p == ' ')
+      {
+        *p++ = 0;
+        continue;
+      }
+      if (tokenCount == tokenAlloc)
+      {
+        tokenAlloc *= 2;
+        b->tokens = reallocate(b->tokens, sizeof(char *) * tokenAlloc);
+      }
+      b->tokens[tokenCount++] = p;
+      while (*p != ' ' && *p != '\n') p++;
+    }
+    *p++ = 0;
+    if (b->lineToken[b->lineCount] == (long long) tokenCount)
+    {
+      fprintf(stderr, "empty line in %s\n", filename);
+      fatal("");
+    }
+    b->lineCount += 1;
+  }
+  b->lineToken[b->lineCount] = tokenCount;
+
+  // number the lines
+  long long count = b->lineCount;
+  b->firstLine = 0;
+  MPI_Exscan(&count, &b->firstLine, 1, MPI_LONG_LONG, MPI_SUM,
+    MPI_COMM_WORLD);
+  if (rank == 0) b->firstLine = 0;
+  b->lineStarts = allocate(sizeof(long long) * (size + 1));
+  MPI_Allgather(&b->firstLine, 1, MPI_LONG_LONG, b->lineStarts, 1,
+    MPI_LONG_LONG, MPI_COMM_WORLD);
+  MPI_Allreduce(&count, &b->totalLines, 1, MPI_LONG_LONG, MPI_SUM,
+    MPI_COMM_WORLD);
+  b->lineStarts[size] = b->totalLines;
+}
+
+// the lines of the hits file, whose genes are numbered by line
+static LineBlock hits;
+
+// the numbers given to genes that are hit but have no line in the hits
+// file start at hits.totalLines; unknownStarts[p] is where the numbers
+// given by process p start (relative to hits.totalLines)
+static long long *unknownStarts;
+static char **unknownNames;
+static long long unknownCount;
+
+/*
+ * The process that owns a gene: the one that read its line, or, for a gene
+ * without a line, the one that numbered it.
+ */
+int geneOwner(GeneId gene)
+{
+  long long *starts = hits.lineStarts;
+  if (gene >= hits.totalLines)
+  {
+    starts = unknownStarts;
+    gene -= hits.totalLines;
+  }
+  int low = 0;
+  int high = size - 1;
+  while (low < high)
+  {
+    int middle = (low + high + 1) / 2;
+    if (starts[middle] <= gene) low = middle;
+    else high = middle - 1;
+  }
+  return low;
+}
+
+/*
+ * Index of one of this process's genes among the genes it owns.
+ */
+long long localIndex(GeneId gene)
+{
+  if (gene < hits.totalLines) return gene - hits.firstLine;
+  return hits.lineCount + (gene - hits.totalLines - unknownStarts[rank]);
+}
+
+GeneId localGene(long long index)
+{
+  if (index < hits.lineCount) return hits.firstLine + index;
+  return hits.totalLines + unknownStarts[rank] + (index - hits.lineCount);
+}
+
+char *localName(GeneId gene)
+{
+  long long index = localIndex(gene);
+  if (index < hits.lineCount) return hits.tokens[hits.lineToken[index]];
+  return unknownNames[index - hits.lineCount];
+}
+
+int dictionaryOwner(const char *name)
+{
+  return hashString(name) % size;
+}
+
+/*
+ * Enter the genes of the lines of the hits file in the dictionary, each
+ * process keeping the names that hash to it.
+ */
+void buildDictionary(HashTable *dictionary, char **keep)
+{
+  Buffer *out = newBuffers();
+  size_t *displs = allocate(sizeof(size_t) * (size + 1));
+  int i;
+
+  for (i = 0; i < hits.lineCount; i++)
+  {
+    char *name = hits.tokens[hits.lineToken[i]];
+    GeneId gene = hits.firstLine + i;
+    int p = dictionaryOwner(name);
+    bufferAppend(&out[p], &gene, sizeof(GeneId));
+    bufferAppend(&out[p], name, strlen(name) + 1);
+  }
+
+  char *in = exchange(out, displs);
+  size_t at = 0;
+  while (at < displs[size])
+  {
+    GeneId gene;
+    memcpy(&gene, in + at, sizeof(GeneId));
+    char *name = in + at + sizeof(GeneId);
+    at += sizeof(GeneId) + strlen(name) + 1;
+    if (hashFind(dictionary, name)->key != NULL)
+    {
+      fprintf(stderr, "gene %s has more than one line in the hits file\n",
+        name);
+      fatal("");
+    }
+    hashInsert(dictionary, name, gene);
+  }
+
+  // the names are in the received bytes, so they are kept
+  *keep = in;
+  freeBuffers(out);
+  free(displs);
+}
+
+/*
+ * Look up the numbers of a list of gene names. Genes that are not in the
+ * dictionary are numbered after the genes that have lines, by the process
+ * that owns their name in the dictionary.
+ */
+void lookupGenes(HashTable *dictionary, char **names, size_t count,
+  GeneId *genes)
+{
+  Buffer *out = newBuffers();
+  size_t *displs = allocate(sizeof(size_t) * (size + 1));
+  size_t i;
+  int p;
+
+  for (i = 0; i < count; i++)
+  {
+    p = dictionaryOwner(names[i]);
+    bufferAppend(&out[p], names[i], strlen(names[i]) + 1);
+  }
+  char *in = exchange(out, displs);
+
+  // look up the names, giving new genes provisional negative numbers
+  size_t allocUnknown = 1024;
+  unknownNames = allocate(sizeof(char *) * allocUnknown);
+  unknownCount = 0;
+  size_t requestCount = 0;
+  size_t at;
+  for (at = 0; at < displs[size]; at += strlen(in + at) + 1)
+  {
+    requestCount += 1;
+  }
+  GeneId *answers = allocate(sizeof(GeneId) * requestCount);
+  requestCount = 0;
+  for (at = 0; at < displs[size]; at += strlen(in + at) + 1)
+  {
+    HashEntry *e = hashFind(dictionary, in + at);
+    if (e->key == NULL)
+    {
+      if ((size_t) unknownCount == allocUnknown)
+      {
+        allocUnknown *= 2;
+        unknownNames = reallocate(unknownNames, sizeof(char *) * allocUnknown);
+      }
+      unknownNames[unknownCount] = strdup(in + at);
+      unknownCount += 1;
+      hashInsert(dictionary, unknownNames[unknownCount-1], -unknownCount);
+      e = hashFind(dictionary, in + at);
+    }
+    answers[requestCount++] = e->value;
+  }
+
+  unknownStarts = allocate(sizeof(long long) * (size + 1));
+  long long base = 0;
+  MPI_Exscan(&unknownCount, &base, 1, MPI_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+  if (rank == 0) base = 0;
+  MPI_Allgather(&base, 1, MPI_LONG_LONG, unknownStarts, 1, MPI_LONG_LONG,
+    MPI_COMM_WORLD);
+  long long totalUnknown;
+  MPI_Allreduce(&unknownCount, &totalUnknown, 1, MPI_LONG_LONG, MPI_SUM,
+    MPI_COMM_WORLD);
+  unknownStarts[size] = totalUnknown;
+
+  // answer in the order of the requests
+  requestCount = 0;
+  for (p = 0; p < size; p++)
+  {
+    for (at = displs[p]; at < displs[p+1]; at += strlen(in + at) + 1)
+    {
+      GeneId gene = answers[requestCount++];
+      if (gene < 0) gene = hits.totalLines + base + (-gene - 1);
+      bufferAppend(&out[p], &gene, sizeof(GeneId));
+    }
+  }
+  HashEntry *e;
+  for (e = dictionary->entries; e < dictionary->entries + dictionary->alloc;
+       e++)
+  {
+    if (e->key != NULL && e->value < 0)
+    {
+      e->value = hits.totalLines + base + (-e->value - 1);
+    }
+  }
+  free(in);
+  free(answers);
+
+  in = exchange(out, displs);
+  size_t *cursor = allocate(sizeof(size_t) * size);
+  for (p = 0; p < size; p++) cursor[p] = displs[p];
+  for (i = 0; i < count; i++)
+  {
+    p = dictionaryOwner(names[i]);
+    memcpy(&genes[i], in + cursor[p], sizeof(GeneId));
+    cursor[p] += sizeof(GeneId);
+  }
+
+  free(cursor);
+  free(in);
+  freeBuffers(out);
+  free(displs);
+}
+
+int compareEdges(const void *a, const void *b)
+{
+  const Edge *x = a;
+  const Edge *y = b;
+  if (x->line != y->line) return x->line < y->line ? -1 : 1;
+  if (x->hit != y->hit) return x->hit < y->hit ? -1 : 1;
+  return x->position - y->position;
+}
+
+int compareEdgePositions(const void *a, const void *b)
+{
+  const Edge *x = a;
+  const Edge *y = b;
+  if (x->line != y->line) return x->line < y->line ? -1 : 1;
+  return x->position - y->position;
+}
+
+int compareComponentEdges(const void *a, const void *b)
+{
+  const ComponentEdge *x = a;
+  const ComponentEdge *y = b;
+  if (x->label != y->label) return x->label < y->label ? -1 : 1;
+  if (x->line != y->line) return x->line < y->line ? -1 : 1;
+  return x->position - y->position;
+}
+
+int compareGeneIds(const void *a, const void *b)
+{
+  GeneId x = *(const GeneId *) a;
+  GeneId y = *(const GeneId *) b;
+  return (x > y) - (x < y);
+}
+
+int compareFamilies(const void *a, const void *b)
+{
+  const Family *x = a;
+  const Family *y = b;
+  return (x->number > y->number) - (x->number < y->number);
+}
+
+/*
+ * Find the hits that will be used to build the families: the hits of the
+ * genes of this process's lines, keeping, for -reciprocal, only those
+ * that are also in the gene's reverse hits. A hit is only kept once per
+ * line, at its first position.
+ */
+Edge *findEdges(GeneId *hitGenes, int reciprocal, LineBlock *reverse,
+  GeneId *reverseGenes, size_t *edgeCount)
+{
+  size_t count = hits.lineToken[hits.lineCount] - hits.lineCount;
+  Edge *edges = allocate(sizeof(Edge) * count);
+  size_t n = 0;
+  int i;
+  long long t;
+
+  for (i = 0; i < hits.lineCount; i++)
+  {
+    for (t = hits.lineToken[i] + 1; t < hits.lineToken[i+1]; t++)
+    {
+      edges[n].line = hits.firstLine + i;
+      edges[n].hit = hitGenes[t];
+      edges[n].position = t - hits.lineToken[i] - 1;
+      n += 1;
+    }
+  }
+
+  // keep the first position of each hit of a line
+  qsort(edges, n, sizeof(Edge), compareEdges);
+  size_t kept = 0;
+  size_t e;
+  for (e = 0; e < n; e++)
+  {
+    if (kept > 0 && edges[kept-1].line == edges[e].line &&
+        edges[kept-1].hit == edges[e].hit)
+    {
+      continue;
+    }
+    edges[kept++] = edges[e];
+  }
+  n = kept;
+
+  if (reciprocal)
+  {
+    // send each reverse hit to the owner of the line's gene
+    Buffer *out = newBuffers();
+    size_t *displs = allocate(sizeof(size_t) * (size + 1));
+    for (i = 0; i < reverse->lineCount; i++)
+    {
+      GeneId gene = reverseGenes[reverse->lineToken[i]];
+      int p = geneOwner(gene);
+      for (t = reverse->lineToken[i] + 1; t < reverse->lineToken[i+1]; t++)
+      {
+        Edge r = { gene, reverseGenes[t], 0 };
+        bufferAppend(&out[p], &r, sizeof(Edge));
+      }
+    }
+    char *in = exchange(out, displs);
+    Edge *reverseEdges = (Edge *) in;
+    size_t reverseCount = displs[size] / sizeof(Edge);
+    qsort(reverseEdges, reverseCount, sizeof(Edge), compareEdges);
+
+    kept = 0;
+    for (e = 0; e < n; e++)
+    {
+      Edge key = { edges[e].line, edges[e].hit, 0 };
+      size_t low = 0;
+      size_t high = reverseCount;
+      while (low < high)
+      {
+        size_t middle = (low + high) / 2;
+        if (compareEdges(&reverseEdges[middle], &key) < 0) low = middle + 1;
+        else high = middle;
+      }
+      if (low < reverseCount && reverseEdges[low].line == key.line &&
+          reverseEdges[low].hit == key.hit)
+      {
+        edges[kept++] = edges[e];
+      }
+    }
+    n = kept;
+
+    free(in);
+    freeBuffers(out);
+    free(displs);
+  }
+
+  qsort(edges, n, sizeof(Edge), compareEdgePositions);
+  *edgeCount = n;
+  return edges;
+}
+
+/*
+ * Ask the owners of a list of genes for a value they hold for each one.
+ * The answers are in the order of the genes.
+ */
+void askOwners(GeneId *genes, size_t count, GeneId *values,
+  GeneId (*answer)(GeneId, void *), void *context)
+{
+  Buffer *out = newBuffers();
+  size_t *displs = allocate(sizeof(size_t) * (size + 1));
+  size_t i;
+  int p;
+
+  for (i = 0; i < count; i++)
+  {
+    bufferAppend(&out[geneOwner(genes[i])], &genes[i], sizeof(GeneId));
+  }
+  char *in = exchange(out, displs);
+  for (p = 0; p < size; p++)
+  {
+    size_t at;
+    for (at = displs[p]; at < displs[p+1]; at += sizeof(GeneId))
+    {
+      GeneId gene;
+      memcpy(&gene, in + at, sizeof(GeneId));
+      GeneId value = answer(gene, context);
+      bufferAppend(&out[p], &value, sizeof(GeneId));
+    }
+  }
+  free(in);
+
+  in = exchange(out, displs);
+  size_t *cursor = allocate(sizeof(size_t) * size);
+  for (p = 0; p < size; p++) cursor[p] = displs[p];
+  for (i = 0; i < count; i++)
+  {
+    p = geneOwner(genes[i]);
+    memcpy(&values[i], in + cursor[p], sizeof(GeneId));
+    cursor[p] += sizeof(GeneId);
+  }
+
+  free(cursor);
+  free(in);
+  freeBuffers(out);
+  free(displs);
+}
+
+GeneId answerLabel(GeneId gene, void *context)
+{
+  GeneId *label = context;
+  return label[localIndex(gene)];
+}
+
+/*
+ * Label each of this process's genes with the smallest gene number in its
+ * connected component.
+ */
+GeneId *findComponents(Edge *edges, size_t edgeCount, long long localCount)
+{
+  GeneId *label = allocate(sizeof(GeneId) * localCount);
+  GeneId *hitLabels = allocate(sizeof(GeneId) * edgeCount);
+  GeneId *genes = allocate(sizeof(GeneId) * localCount);
+  GeneId *jumped = allocate(sizeof(GeneId) * localCount);
+  Buffer *out = newBuffers();
+  size_t *displs = allocate(sizeof(size_t) * (size + 1));
+  long long i;
+  size_t e;
+
+  for (i = 0; i < localCount; i++) label[i] = localGene(i);
+
+  GeneId *hitGenes = allocate(sizeof(GeneId) * edgeCount);
+  for (e = 0; e < edgeCount; e++) hitGenes[e] = edges[e].hit;
+
+  int changed = 1;
+  int rounds = 0;
+  while (changed)
+  {
+    int localChanged = 0;
+    rounds += 1;
+
+    // give both genes of each hit the smaller of their labels
+    askOwners(hitGenes, edgeCount, hitLabels, answerLabel, label);
+    for (e = 0; e < edgeCount; e++)
+    {
+      long long u = localIndex(edges[e].line);
+      GeneId smaller = label[u] < hitLabels[e] ? label[u] : hitLabels[e];
+      if (smaller < label[u])
+      {
+        label[u] = smaller;
+        localChanged = 1;
+      }
+      if (smaller < hitLabels[e])
+      {
+        GeneId update[2] = { edges[e].hit, smaller };
+        bufferAppend(&out[geneOwner(edges[e].hit)], update, sizeof(update));
+      }
+    }
+    char *in = exchange(out, displs);
+    size_t at;
+    for (at = 0; at < displs[size]; at += 2 * sizeof(GeneId))
+    {
+      GeneId update[2];
+      memcpy(update, in + at, sizeof(update));
+      i = localIndex(update[0]);
+      if (update[1] < label[i])
+      {
+        label[i] = update[1];
+        localChanged = 1;
+      }
+    }
+    free(in);
+
+    // pointer jumping: take the label of the label until none change
+    int jumping = 1;
+    while (jumping)
+    {
+      int localJumping = 0;
+      for (i = 0; i < localCount; i++) genes[i] = label[i];
+      askOwners(genes, localCount, jumped, answerLabel, label);
+      for (i = 0; i < localCount; i++)
+      {
+        if (jumped[i] < label[i])
+        {
+          label[i] = jumped[i];
+          localJumping = 1;
+          localChanged = 1;
+        }
+      }
+      MPI_Allreduce(&localJumping, &jumping, 1, MPI_INT, MPI_LOR,
+        MPI_COMM_WORLD);
+    }
+
+    MPI_Allreduce(&localChanged, &changed, 1, MPI_INT, MPI_LOR,
+      MPI_COMM_WORLD);
+  }
+
+  if (rank == 0)
+  {
+    printf("components found after %d rounds.\n", rounds);
+  }
+
+  free(hitLabels);
+  free(hitGenes);
+  free(genes);
+  free(jumped);
+  freeBuffers(out);
+  free(displs);
+  return label;
+}
+
+/*
+ * Replay findHomologFamilies.pl on the hits of one component, which are
+ * in the order the script reads them. Adds the line of each family that
+ * is created to the created list, and returns the surviving family.
+ */
+Family replayComponent(ComponentEdge *edges, size_t edgeCount,
+  GeneId **created, size_t *createdCount, size_t *createdAlloc)
+{
+  size_t e;
+
+  // number the genes of the component
+  GeneId *genes = allocate(sizeof(GeneId) * 2 * edgeCount);
+  size_t geneCount = 0;
+  for (e = 0; e < edgeCount; e++)
+  {
+    genes[geneCount++] = edges[e].line;
+    genes[geneCount++] = edges[e].hit;
+  }
+  qsort(genes, geneCount, sizeof(GeneId), compareGeneIds);
+  size_t distinct = 0;
+  for (e = 0; e < geneCount; e++)
+  {
+    if (distinct == 0 || genes[distinct-1] != genes[e])
+    {
+      genes[distinct++] = genes[e];
+    }
+  }
+
+  // the family of each gene, and for each family, the line at which it
+  // was created, the family it was merged into (itself if none), and its
+  // list of genes
+  long long *familyOf = allocate(sizeof(long long) * distinct);
+  long long *parent = allocate(sizeof(long long) * edgeCount);
+  GeneId *familyLine = allocate(sizeof(GeneId) * edgeCount);
+  long long *head = allocate(sizeof(long long) * edgeCount);
+  long long *tail = allocate(sizeof(long long) * edgeCount);
+  long long *next = allocate(sizeof(long long) * 2 * edgeCount);
+  GeneId *node = allocate(sizeof(GeneId) * 2 * edgeCount);
+  long long familyCount = 0;
+  long long nodeCount = 0;
+  for (e = 0; e < distinct; e++) familyOf[e] = -1;
+
+  for (e = 0; e < edgeCount; e++)
+  {
+    GeneId gene[2] = { edges[e].line, edges[e].hit };
+    long long index[2];
+    long long family[2];
+    int k;
+    for (k = 0; k < 2; k++)
+    {
+      GeneId *found = bsearch(&gene[k], genes, distinct, sizeof(GeneId),
+        compareGeneIds);
+      index[k] = found - genes;
+      family[k] = familyOf[index[k]];
+      if (family[k] >= 0)
+      {
+        while (parent[family[k]] != family[k])
+        {
+          parent[family[k]] = parent[parent[family[k]]];
+          family[k] = parent[family[k]];
+        }
+      }
+    }
+
+    if (family[0] < 0 && family[1] < 0)
+    {
+      // a new family of the two genes (the same gene twice for a self-hit)
+      long long f = familyCount++;
+      parent[f] = f;
+      familyLine[f] = edges[e].line;
+      head[f] = nodeCount;
+      for (k = 0; k < 2; k++)
+      {
+        node[nodeCount] = gene[k];
+        next[nodeCount] = nodeCount + 1;
+        nodeCount += 1;
+        familyOf[index[k]] = f;
+      }
+      next[nodeCount-1] = -1;
+      tail[f] = nodeCount - 1;
+
+      if (*createdCount == *createdAlloc)
+      {
+        *createdAlloc *= 2;
+        *created = reallocate(*created, sizeof(GeneId) * *createdAlloc);
+      }
+      (*created)[(*createdCount)++] = edges[e].line;
+    }
+    else if (family[0] < 0 || family[1] < 0)
+    {
+      // add the gene that is not in a family to the other's family
+      int in = (family[0] >= 0) ? 0 : 1;
+      int out = 1 - in;
+      long long f = family[in];
+      node[nodeCount] = gene[out];
+      next[nodeCount] = -1;
+      next[tail[f]] = nodeCount;
+      tail[f] = nodeCount;
+      nodeCount += 1;
+      familyOf[index[out]] = f;
+    }
+    else if (family[0] != family[1])
+    {
+      // the family of the line's gene takes in the other family
+      long long f = family[0];
+      long long g = family[1];
+      next[tail[f]] = head[g];
+      tail[f] = tail[g];
+      parent[g] = f;
+    }
+  }
+
+  long long survivor = familyOf[0];
+  while (parent[survivor] != survivor) survivor = parent[survivor];
+
+  Family result;
+  result.line = familyLine[survivor];
+  result.number = -1;
+  result.geneCount = 0;
+  result.genes = allocate(sizeof(GeneId) * nodeCount);
+  result.names = NULL;
+  long long n;
+  for (n = head[survivor]; n >= 0; n = next[n])
+  {
+    result.genes[result.geneCount++] = node[n];
+  }
+
+  free(genes);
+  free(familyOf);
+  free(parent);
+  free(familyLine);
+  free(head);
+  free(tail);
+  free(next);
+  free(node);
+  return result;
+}
+
+/*
+ * The sorted lines, among those owned by this process, at which families
+ * were created, and the number of such lines owned by earlier processes.
+ */
+typedef struct
+{
+  GeneId *lines;
+  long long count;
+  long long base;
+} CreatedLines;
+
+/*
+ * The number of a family is the count of lines before its own at which
+ * families were created.
+ */
+GeneId answerNumber(GeneId line, void *context)
+{
+  CreatedLines *created = context;
+  GeneId *found = bsearch(&line, created->lines, created->count,
+    sizeof(GeneId), compareGeneIds);
+  return created->base + (found - created->lines);
+}
+
+/*
+ * Count the hits of each component at the owner of its label, and stop
+ * with an error if any component has more than MAX_COMPONENT_EDGES, since
+ * the one process that replays it would run out of memory.
+ */
+void checkComponentSizes(Edge *edges, size_t edgeCount, GeneId *label,
+  Buffer *out, size_t *displs)
+{
+  size_t e;
+
+  // count the hits of each label locally, as (label, count) pairs
+  GeneId *labels = allocate(sizeof(GeneId) * (edgeCount + 1));
+  for (e = 0; e < edgeCount; e++)
+  {
+    labels[e] = label[localIndex(edges[e].line)];
+  }
+  qsort(labels, edgeCount, sizeof(GeneId), compareGeneIds);
+  size_t first = 0;
+  while (first < edgeCount)
+  {
+    size_t last = first;
+    while (last < edgeCount && labels[last] == labels[first]) last += 1;
+    GeneId pair[2];
+    pair[0] = labels[first];
+    pair[1] = last - first;
+    bufferAppend(&out[geneOwner(pair[0])], pair, sizeof(pair));
+    first = last;
+  }
+  free(labels);
+
+  // add up the counts of each label at its owner
+  char *in = exchange(out, displs);
+  GeneId *pairs = (GeneId *) in;
+  size_t pairCount = displs[size] / (2 * sizeof(GeneId));
+  qsort(pairs, pairCount, 2 * sizeof(GeneId), compareGeneIds);
+  long long largest = 0;
+  first = 0;
+  while (first < pairCount)
+  {
+    long long total = 0;
+    size_t last = first;
+    while (last < pairCount && pairs[2*last] == pairs[2*first])
+    {
+      total += pairs[2*last + 1];
+      last += 1;
+    }
+    if (total > largest) largest = total;
+    first = last;
+  }
+  free(in);
+
+  long long globalLargest;
+  MPI_Allreduce(&largest, &globalLargest, 1, MPI_LONG_LONG, MPI_MAX,
+    MPI_COMM_WORLD);
+  if (globalLargest > MAX_COMPONENT_EDGES)
+  {
+    if (rank == 0)
+    {
+      fprintf(stderr, "a family has %lld hits, more than the %lld that one "
+        "process can hold (see MAX_COMPONENT_EDGES)\n", globalLargest,
+        (long long) MAX_COMPONENT_EDGES);
+    }
+    fatal("");
+  }
+}
+
+/*
+ * Build the families of the components whose labels this process owns.
+ */
+Family *buildFamilies(Edge *edges, size_t edgeCount, GeneId *label,
+  size_t *familyCount)
+{
+  Buffer *out = newBuffers();
+  size_t *displs = allocate(sizeof(size_t) * (size + 1));
+  size_t e;
+
+  checkComponentSizes(edges, edgeCount, label, out, displs);
+
+  for (e = 0; e < edgeCount; e++)
+  {
+    ComponentEdge c;
+    c.label = label[localIndex(edges[e].line)];
+    c.line = edges[e].line;
+    c.hit = edges[e].hit;
+    c.position = edges[e].position;
+    bufferAppend(&out[geneOwner(c.label)], &c, sizeof(ComponentEdge));
+  }
+  char *in = exchange(out, displs);
+  ComponentEdge *componentEdges = (ComponentEdge *) in;
+  size_t count = displs[size] / sizeof(ComponentEdge);
+  qsort(componentEdges, count, sizeof(ComponentEdge), compareComponentEdges);
+
+  size_t familyAlloc = 1024;
+  Family *families = allocate(sizeof(Family) * familyAlloc);
+  size_t createdAlloc = 1024;
+  size_t createdCount = 0;
+  GeneId *created = allocate(sizeof(GeneId) * createdAlloc);
+  *familyCount = 0;
+  size_t first = 0;
+  while (first < count)
+  {
+    size_t last = first;
+    while (last < count &&
+           componentEdges[last].label == componentEdges[first].label)
+    {
+      last += 1;
+    }
+    if (*familyCount == familyAlloc)
+    {
+      familyAlloc *= 2;
+      families = reallocate(families, sizeof(Family) * familyAlloc);
+    }
+    families[(*familyCount)++] = replayComponent(componentEdges + first,
+      last - first, &created, &createdCount, &createdAlloc);
+    first = last;
+  }
+  free(in);
+
+  // number the families by the lines at which families were created:
+  // send each such line to the process that owns the line's gene, which
+  // counts them, and then ask it the number for each family's line
+  for (e = 0; e < createdCount; e++)
+  {
+    bufferAppend(&out[geneOwner(created[e])], &created[e], sizeof(GeneId));
+  }
+  free(created);
+  in = exchange(out, displs);
+  GeneId *lines = (GeneId *) in;
+  long long lineCount = displs[size] / sizeof(GeneId);
+  qsort(lines, lineCount, sizeof(GeneId), compareGeneIds);
+  long long base = 0;
+  MPI_Exscan(&lineCount, &base, 1, MPI_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+  if (rank == 0) base = 0;
+
+  GeneId *familyLines = allocate(sizeof(GeneId) * (*familyCount + 1));
+  GeneId *numbers = allocate(sizeof(GeneId) * (*familyCount + 1));
+  for (e = 0; e < *familyCount; e++) familyLines[e] = families[e].line;
+
+  CreatedLines context = { lines, lineCount, base };
+  askOwners(familyLines, *familyCount, numbers, answerNumber, &context);
+  for (e = 0; e < *familyCount; e++) families[e].number = numbers[e];
+
+  free(in);
+  free(familyLines);
+  free(numbers);
+  freeBuffers(out);
+  free(displs);
+  return families;
+}
+
+/*
+ * Get the names of the genes of this process's families from the
+ * processes that own the genes.
+ */
+void nameGenes(Family *families, size_t familyCount)
+{
+  Buffer *out = newBuffers();
+  size_t *displs = allocate(sizeof(size_t) * (size + 1));
+  size_t f;
+  int g;
+  int p;
+
+  for (f = 0; f < familyCount; f++)
+  {
+    for (g = 0; g < families[f].geneCount; g++)
+    {
+      GeneId gene = families[f].genes[g];
+      bufferAppend(&out[geneOwner(gene)], &gene, sizeof(GeneId));
+    }
+  }
+  char *in = exchange(out, displs);
+  size_t at;
+  for (p = 0; p < size; p++)
+  {
+    for (at = displs[p]; at < displs[p+1]; at += sizeof(GeneId))
+    {
+      GeneId gene;
+      memcpy(&gene, in + at, sizeof(GeneId));
+      char *name = localName(gene);
+      bufferAppend(&out[p], name, strlen(name) + 1);
+    }
+  }
+  free(in);
+
+  // the names are kept in the received bytes
+  in = exchange(out, displs);
+  size_t *cursor = allocate(sizeof(size_t) * size);
+  for (p = 0; p < size; p++) cursor[p] = displs[p];
+  for (f = 0; f < familyCount; f++)
+  {
+    families[f].names = allocate(sizeof(char *) * families[f].geneCount);
+    for (g = 0; g < families[f].geneCount; g++)
+    {
+      p = geneOwner(families[f].genes[g]);
+      families[f].names[g] = in + cursor[p];
+      cursor[p] += strlen(in + cursor[p]) + 1;
+    }
+  }
+
+  free(cursor);
+  freeBuffers(out);
+  free(displs);
+}
+
+/*
+ * Copy the genome of a gene (the part of its name before any '$') into a
+ * buffer, returning the buffer.
+ */
+char *genomeOf(const char *gene, Buffer *b)
+{
+  const char *dollar = strchr(gene, '$');
+  size_t n = dollar == NULL ? strlen(gene) : (size_t) (dollar - gene);
+  b->length = 0;
+  bufferAppend(b, gene, n);
+  bufferAppend(b, "", 1);
+  return b->data;
+}
+
+/*
+ * Find the genomes of the genes of the hits file, in the order in which
+ * they first appear, and enter them in a table giving their position in
+ * that order. Every process gets the list.
+ */
+char **listGenomes(HashTable *table, int *genomeCount)
+{
+  HashTable seen;
+  Buffer local = { NULL, 0, 0 };
+  Buffer name = { NULL, 0, 0 };
+  int i;
+  int p;
+
+  hashInit(&seen);
+  for (i = 0; i < hits.lineCount; i++)
+  {
+    char *genome = genomeOf(hits.tokens[hits.lineToken[i]], &name);
+    if (hashFind(&seen, genome)->key == NULL)
+    {
+      hashInsert(&seen, strdup(genome), 0);
+      bufferAppend(&local, genome, strlen(genome) + 1);
+    }
+  }
+
+  // process 0 merges the lists in process order and sends the result
+  int length = local.length;
+  int *lengths = allocate(sizeof(int) * size);
+  int *displs = allocate(sizeof(int) * size);
+  MPI_Gather(&length, 1, MPI_INT, lengths, 1, MPI_INT, 0, MPI_COMM_WORLD);
+  long long total = 0;
+  if (rank == 0)
+  {
+    for (p = 0; p < size; p++)
+    {
+      displs[p] = total;
+      total += lengths[p];
+      if (total > INT_MAX) fatal("too many genomes");
+    }
+  }
+  char *all = allocate(total);
+  MPI_Gatherv(local.data, length, MPI_CHAR, all, lengths, displs, MPI_CHAR,
+    0, MPI_COMM_WORLD);
+
+  Buffer merged = { NULL, 0, 0 };
+  hashInit(table);
+  if (rank == 0)
+  {
+    size_t at;
+    for (at = 0; at < (size_t) total; at += strlen(all + at) + 1)
+    {
+      if (hashFind(table, all + at)->key == NULL)
+      {
+        hashInsert(table, all + at, 0);
+        bufferAppend(&merged, all + at, strlen(all + at) + 1);
+      }
+    }
+  }
+  length = merged.length;
+  MPI_Bcast(&length, 1, MPI_INT, 0, MPI_COMM_WORLD);
+  if (rank != 0) merged.data = allocate(length);
+  MPI_Bcast(merged.data, length, MPI_CHAR, 0, MPI_COMM_WORLD);
+
+  // rebuild the table from the merged list, which is kept
+  free(table->entries);
+  hashInit(table);
+  *genomeCount = 0;
+  size_t at;
+  for (at = 0; at < (size_t) length; at += strlen(merged.data + at) + 1)
+  {
+    *genomeCount += 1;
+  }
+  char **genomes = allocate(sizeof(char *) * (*genomeCount + 1));
+  *genomeCount = 0;
+  for (at = 0; at < (size_t) length; at += strlen(merged.data + at) + 1)
+  {
+    genomes[*genomeCount] = merged.data + at;
+    hashInsert(table, merged.data + at, *genomeCount);
+    *genomeCount += 1;
+  }
+
+  for (i = 0; i < (int) seen.alloc; i++) free(seen.entries[i].key);
+  free(seen.entries);
+  free(local.data);
+  free(name.data);
+  free(all);
+  free(lengths);
+  free(displs);
+  return genomes;
+}
+
+/*
+ * Append a family, as its number followed by its lines of the family file
+ * and of the csv file, to a buffer.
+ */
+void formatFamily(Family *family, HashTable *genomes, int genomeCount,
+  int *counts, Buffer *b)
+{
+  Buffer text = { NULL, 0, 0 };
+  Buffer name = { NULL, 0, 0 };
+  char number[32];
+  int g;
+
+  snprintf(number, sizeof(number), "%lld", family->number);
+  bufferAppend(&text, number, strlen(number));
+  bufferAppend(&text, ":", 1);
+  for (g = 0; g < genomeCount; g++) counts[g] = 0;
+  for (g = 0; g < family->geneCount; g++)
+  {
+    HashEntry *e = hashFind(genomes, genomeOf(family->names[g], &name));
+    if (e->key != NULL) counts[e->value] += 1;
+    bufferAppend(&text, " ", 1);
+    bufferAppend(&text, family->names[g], strlen(family->names[g]));
+  }
+  bufferAppend(&text, "\n", 1);
+  long long familyLength = text.length;
+
+  bufferAppend(&text, number, strlen(number));
+  for (g = 0; g < genomeCount; g++)
+  {
+    char count[32];
+    snprintf(count, sizeof(count), ",%d", counts[g]);
+    bufferAppend(&text, count, strlen(count));
+  }
+  bufferAppend(&text, "\n", 1);
+  long long csvLength = text.length - familyLength;
+
+  bufferAppend(b, &family->number, sizeof(GeneId));
+  bufferAppend(b, &familyLength, sizeof(long long));
+  bufferAppend(b, &csvLength, sizeof(long long));
+  bufferAppend(b, text.data, text.length);
+
+  free(text.data);
+  free(name.data);
+}
+
+/*
+ * Send this process's families, in order of their numbers, to the writer
+ * in batches. An empty batch ends them.
+ */
+void sendFamilies(Family *families, size_t familyCount, HashTable *genomes,
+  int genomeCount)
+{
+  Buffer batch = { NULL, 0, 0 };
+  int *counts = allocate(sizeof(int) * (genomeCount + 1));
+  size_t f;
+
+  for (f = 0; f < familyCount; f++)
+  {
+    formatFamily(&families[f], genomes, genomeCount, counts, &batch);
+    if (batch.length >= BATCH_SIZE || f == familyCount - 1)
+    {
+      if (batch.length > INT_MAX) fatal("family too large to send");
+      MPI_Send(batch.data, batch.length, MPI_BYTE, WRITER_PROCESS,
+        FAMILY_TAG, MPI_COMM_WORLD);
+      batch.length = 0;
+    }
+  }
+  MPI_Send(batch.data, 0, MPI_BYTE, WRITER_PROCESS, FAMILY_TAG,
+    MPI_COMM_WORLD);
+
+  free(counts);
+  free(batch.data);
+}
+
+/*
+ * The writer's view of the families of one process: the batch being
+ * read, and where the next family in it starts.
+ */
+typedef struct
+{
+  char *batch;
+  int length;
+  int at;
+  int done;
+} Source;
+
+void receiveBatch(Source *s, int from)
+{
+  MPI_Status status;
+  free(s->batch);
+  MPI_Probe(from, FAMILY_TAG, MPI_COMM_WORLD, &status);
+  MPI_Get_count(&status, MPI_BYTE, &s->length);
+  s->batch = allocate(s->length);
+  MPI_Recv(s->batch, s->length, MPI_BYTE, from, FAMILY_TAG, MPI_COMM_WORLD,
+    &status);
+  s->at = 0;
+  s->done = (s->length == 0);
+}
+
+/*
+ * Receive the families from the other processes, merging them with this
+ * process's own by number, and write them to the output files.
+ */
+void writeFamilies(const char *outputFile, char **genomes, int genomeCount,
+  Family *families, size_t familyCount, HashTable *genomeTable)
+{
+  char *csvFile = allocate(strlen(outputFile) + 5);
+  sprintf(csvFile, "%s.csv", outputFile);
+  FILE *family = fopen(outputFile, "w");
+  if (family == NULL)
+  {
+    fprintf(stderr, "cannot open output (%s)\n", outputFile);
+    fatal("");
+  }
+  FILE *csv = fopen(csvFile, "w");
+  if (csv == NULL)
+  {
+    fprintf(stderr, "cannot open output (%s)\n", csvFile);
+    fatal("");
+  }
+
+  int g;
+  fprintf(csv, "family");
+  for (g = 0; g < genomeCount; g++) fprintf(csv, ",%s", genomes[g]);
+  fprintf(csv, "\n");
+
+  // this process's own families are formatted into a single batch
+  Source *sources = allocate(sizeof(Source) * size);
+  int *counts = allocate(sizeof(int) * (genomeCount + 1));
+  Buffer own = { NULL, 0, 0 };
+  size_t f;
+  int p;
+  for (f = 0; f < familyCount; f++)
+  {
+    formatFamily(&families[f], genomeTable, genomeCount, counts, &own);
+  }
+  for (p = 0; p < size; p++)
+  {
+    sources[p].batch = NULL;
+    if (p == WRITER_PROCESS)
+    {
+      sources[p].batch = own.data;
+      sources[p].length = own.length;
+      sources[p].at = 0;
+      sources[p].done = (own.length == 0);
+    }
+    else
+    {
+      receiveBatch(&sources[p], p);
+    }
+  }
+
+  while (1)
+  {
+    int next = -1;
+    GeneId nextNumber = 0;
+    for (p = 0; p < size; p++)
+    {
+      GeneId number;
+      if (sources[p].done) continue;
+      memcpy(&number, sources[p].batch + sources[p].at, sizeof(GeneId));
+      if (next < 0 || number < nextNumber)
+      {
+        next = p;
+        nextNumber = number;
+      }
+    }
+    if (next < 0) break;
+
+    Source *s = &sources[next];
+    long long familyLength;
+    long long csvLength;
+    memcpy(&familyLength, s->batch + s->at + sizeof(GeneId),
+      sizeof(long long));
+    memcpy(&csvLength, s->batch + s->at + sizeof(GeneId) + sizeof(long long),
+      sizeof(long long));
+    char *text = s->batch + s->at + sizeof(GeneId) + 2 * sizeof(long long);
+    fwrite(text, 1, familyLength, family);
+    fwrite(text + familyLength, 1, csvLength, csv);
+    s->at += sizeof(GeneId) + 2 * sizeof(long long) + familyLength +
+      csvLength;
+    if (s->at == s->length)
+    {
+      if (next == WRITER_PROCESS) s->done = 1;
+      else receiveBatch(s, next);
+    }
+  }
+
+  if (fclose(family) != 0 || fclose(csv) != 0)
+  {
+    fatal("cannot write output");
+  }
+  for (p = 0; p < size; p++) free(sources[p].batch);
+  free(sources);
+  free(counts);
+  free(csvFile);
+}
+
+int main(int argc, char *argv[])
+{
+  MPI_Init(&argc, &argv);
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &size);
+  time_t startTime = time(NULL);
+
+  if (argc < 4 || argc > 5 ||
+      (strcmp(argv[2], "-reciprocal") != 0 &&
+       strcmp(argv[2], "-oneway") != 0) ||
+      ((argc == 5) != (strcmp(argv[2], "-reciprocal") == 0)))
+  {
+    if (rank == 0)
+    {
+      fprintf(stderr,
+        "Usage: mpiHomologFamilies hitsInput -oneway output\n"
+        "       mpiHomologFamilies hitsInput -reciprocal output "
+        "reverseHitsInput\n");
+    }
+    MPI_Finalize();
+    exit(-1);
+  }
+  char *hitsFile = argv[1];
+  int reciprocal = (strcmp(argv[2], "-reciprocal") == 0);
+  char *outputFile = argv[3];
+
+  readLines(hitsFile, &hits);
+
+  LineBlock reverse;
+  if (reciprocal)
+  {
+    readLines(argv[4], &reverse);
+    if (reverse.totalLines < hits.totalLines)
+    {
+      if (rank == 0)
+      {
+        fprintf(stderr, "unexpected EOF on reverse hits file at line %lld!\n",
+          reverse.totalLines + 1);
+      }
+      fatal("");
+    }
+  }
+
+  // number the genes
+  HashTable dictionary;
+  char *dictionaryNames;
+  hashInit(&dictionary);
+  buildDictionary(&dictionary, &dictionaryNames);
+
+  size_t hitTokens = hits.lineToken[hits.lineCount];
+  size_t reverseTokens = reciprocal ? reverse.lineToken[reverse.lineCount] : 0;
+  char **names = allocate(sizeof(char *) * (hitTokens + reverseTokens));
+  GeneId *genes = allocate(sizeof(GeneId) * (hitTokens + reverseTokens));
+  memcpy(names, hits.tokens, sizeof(char *) * hitTokens);
+  if (reciprocal)
+  {
+    memcpy(names + hitTokens, reverse.tokens, sizeof(char *) * reverseTokens);
+  }
+  lookupGenes(&dictionary, names, hitTokens + reverseTokens, genes);
+  free(names);
+
+  GeneId *reverseGenes = NULL;
+  if (reciprocal)
+  {
+    // the lines of the two files must be for the same genes
+    int i;
+    reverseGenes = genes + hitTokens;
+    for (i = 0; i < reverse.lineCount; i++)
+    {
+      GeneId line = reverse.firstLine + i;
+      if (line < hits.totalLines &&
+          reverseGenes[reverse.lineToken[i]] != line)
+      {
+        fprintf(stderr, "gene mismatch (%s) in two input files at line %lld!\n",
+          reverse.tokens[reverse.lineToken[i]], line + 1);
+        fatal("");
+      }
+    }
+  }
+
+  size_t edgeCount;
+  Edge *edges = findEdges(genes, reciprocal, &reverse, reverseGenes,
+    &edgeCount);
+  free(genes);
+
+  long long localCount = hits.lineCount + (unknownStarts[rank + 1] -
+    unknownStarts[rank]);
+  GeneId *label = findComponents(edges, edgeCount, localCount);
+
+  size_t familyCount;
+  Family *families = buildFamilies(edges, edgeCount, label, &familyCount);
+  qsort(families, familyCount, sizeof(Family), compareFamilies);
+  free(edges);
+  free(label);
+
+  MPI_Barrier(MPI_COMM_WORLD);
+  if (rank == 0) printf("families complete.\n");
+
+  nameGenes(families, familyCount);
+  HashTable genomeTable;
+  int genomeCount;
+  char **genomes = listGenomes(&genomeTable, &genomeCount);
+
+  if (rank == WRITER_PROCESS)
+  {
+    writeFamilies(outputFile, genomes, genomeCount, families, familyCount,
+      &genomeTable);
+    printf("families dumped to file.\n");
+    printf("execution complete after %ld seconds.\n",
+      (long) (time(NULL) - startTime));
+  }
+  else
+  {
+    sendFamilies(families, familyCount, &genomeTable, genomeCount);
+  }
+
+  MPI_Finalize();
+  return 0;
+}
@@ -0,0 +1,101 @@
+#!/usr/bin/perl
+
+# $Id$
+#
+# Write to standard output the decompressed contents of some or all of
+# the frames of a compressed mpiBlast output file.
+#
+# When mpiBlast is run with -gzip, its output file is a series of gzip
+# members (frames), each holding the complete BLAST output for one block
+# of queries. When it is also run with -frameindex, the index file has a
+# line for each frame, giving the frame's byte offset and compressed length
+# in the output file, followed by its uncompressed length.
+#
+# Using the index, a frame can be decompressed without reading the frames
+# before it, so several copies of this script (or of a downstream tool that
+# does the same thing) can process disjoint ranges of frames in parallel.
+#
+# It takes two or four arguments:
+#   1. the compressed mpiBlast output file
+#   2. the frame index file
+#   3. optional first frame to output (frames are numbered from 0)
+#   4. optional last frame to output
+#
+# If the frame range is not given, then all frames are output.
+#
+
+use strict;
+use warnings;
+
+use IO::Uncompress::Gunzip qw(gunzip $GunzipError);
+
+if (@ARGV != 2 && @ARGV != 4)
+{
+  die "Usage: catBlastFrames.pl compressedFile indexFile " .
+    "[firstFrame lastFrame]\n";
+}
+
+my $compressedFile = $ARGV[0];
+my $indexFile = $ARGV[1];
+
+# read the frame index
+my @frames = ();
+open(INDEX, "<", $indexFile) or
+  die "cannot open input ($indexFile)\n";
+while (my $line = <INDEX>)
+{
+  chomp($line);
+
+  my ($offset, $length, $uncompressedLength) = split / /, $line;
+  if (!defined($uncompressedLength))
+  {
+    die "cannot parse frame index line: $line\n";
+  }
+  push @frames, [$offset, $length, $uncompressedLength];
+}
+close(INDEX);
+
+my $first = 0;
+my $last = @frames - 1;
+if (@ARGV == 4)
+{
+  $first = $ARGV[2];
+  $last = $ARGV[3];
+  if ($first < 0 || $last >= @frames || $first > $last)
+  {
+    die "bad frame range ($first, $last) for " . scalar(@frames) .
+      " frames\n";
+  }
+}
+
+open(IN, "<", $compressedFile) or
+  die "cannot open input ($compressedFile)\n";
+binmode(IN);
+
+for (my $i = $first; $i <= $last; $i += 1)
+{
+  my ($offset, $length, $uncompressedLength) = @{$frames[$i]};
+
+  # read just this frame and decompress it
+  my $compressed;
+  seek(IN, $offset, 0) or
+    die "cannot seek to frame $i in $compressedFile\n";
+  my $n = read(IN, $compressed, $length);
+  if (!defined($n) || $n != $length)
+  {
+    die "short read of frame $i in $compressedFile\n";
+  }
+
+  my $text;
+  gunzip(\$compressed => \$text) or
+    die "decompression of frame $i failed: $GunzipError\n";
+  if (length($text) != $uncompressedLength)
+  {
+    die "frame $i has length " . length($text) .
+      " but index says $uncompressedLength\n";
+  }
+
+  print $text;
+}
+
+close(IN);
@@ -10,6 +10,13 @@
 #
 # It takes six initial arguments:
 #   1. optional -n (indicating that the FASTA sequences are nucleotides)
+#      and/or optional -shards N (indicating that each database should be
+#      split into N shards that are searched separately by mpiBlast)
+#      and/or optional -prefilter (indicating that kmerPrefilter should be
+#      used to limit the search of each query gene to candidate genes)
+#      and/or optional -dbcache directory megabytes (indicating that the
+#      workers should search copies of the databases kept in the given
+#      node-local directory, limited to the given size)
 #   2. directory containing FASTA sequence files
 #   3. directory containing BLAST results
 #   4. evalue threshold to be passed via -e argument to blastall
@@ -31,7 +38,8 @@
 #
 # And for each new genome these is a file created called <GENOME>.self that
 # contains a line for each non-error gene, with the line containing that
-# gene's self-hit. Error genes are ones which do not have self-hits.
+# gene's self-hit. Error genes are ones which do not have self-hits. The
+# self-hits are computed by selfScore.
 # BLAST results are also filtered to remove these genes. A file <GENOME>.errors
 # is also created that contains these error gene names.
 #
@@ -58,27 +66,130 @@
 #
 # pjh Jul. 2015: Adapt to changes to mpiBlast. In particular now must
 #                explicitly provide the number of hits to keep (500).
+#
+# agent Oct. 2026: mpiBlast is now asked to gzip its output (-gzip), which
+#                greatly reduces the size of the .temp files written into
+#                the blast directory. The .temp file is read back through
+#                IO::Uncompress::Gunzip.
+#
+# agent Oct. 2026: Added the -shards option. The sequences of the database
+#                genome are dealt round-robin into N shard files, each is
+#                formatted, and mpiBlast searches each query block against
+#                every shard and merges the hits. The total length and
+#                number of sequences of the database are passed via -dbsize
+#                and -dbseqs, so mpiBlast can recompute the e-values to be
+#                those of the whole database (see mpiBlast.c).
+#
+# agent Oct. 2026: Added the -prefilter option. For each pair of different
+#                genomes, kmerPrefilter finds the genes of the database
+#                genome that share enough spaced-seed words with each query
+#                gene, and mpiBlast searches each block of queries against
+#                just those candidates. (Self BLASTs were not prefiltered
+#                at first, since they provided the self-hits; see below.)
+#                The sensitivity can be checked with
+#                prefilterSensitivity.pl.
+#
+# agent Oct. 2026: The self-hits are now computed directly by selfScore
+#                rather than taken from the BLAST of each new genome against
+#                itself, so that BLAST no longer has to finish before the
+#                others can start. All the BLASTs now go through one loop,
+#                and self BLASTs are now prefiltered too. Each pair of
+#                genomes is still a separate mpiBlast run, and the runs are
+#                still done one after another; they are not yet scheduled
+#                as one pool of (query block, database) tasks.
+#
+# agent Oct. 2026: The formatted databases are now kept in the dbcache
+#                subdirectory of the blast directory, one directory per
+#                database, named by an MD5 hash of the sequences, the
+#                makeblastdb version and arguments, and the number of
+#                shards. So each database is formatted once, rather than
+#                once per query genome, and is reused by later runs. Added
+#                the -dbcache option, which is passed on to mpiBlast so the
+#                workers copy the databases into node-local storage (e.g.
+#                /dev/shm) rather than reading them over NFS. At the end
+#                of each run, the entries the run did not use are removed
+#                from the dbcache subdirectory.
+#
+# agent Oct. 2026: blastp is now run with -comp_based_stats 0, since the
+#                self-hits from selfScore are scored without
+#                composition-based statistics, and the Lerat ratio of a hit
+#                to its self-hit is only meaningful when both are scored
+#                the same way. The way the BLASTs were scored is recorded
+#                in the SCORING file, and genomes are not added to a blast
+#                directory whose genomes were scored in another way (e.g.
+#                with self BLASTs and composition-based statistics), since
+#                the hits would then be on different scales; such a
+#                directory must be redone from an empty DONE file.
 
 use strict;
 use warnings;
 
 use POSIX;
+use IO::Uncompress::Gunzip qw($GunzipError);
+use Digest::MD5;
 
 if (@ARGV < 5)
 {
-  die "Usage: doPairwiseBlasts.pl [-n] sequenceDirectory blastDirectory " .
+  die "Usage: doPairwiseBlasts.pl [-n] [-shards N] [-prefilter] " .
+    "[-dbcache directory megabytes] sequenceDirectory " .
+    "blastDirectory " .
     "evalueThreshold numberOfProcessors machinefile " .
     "<list of genome names>\n";
 }
 
 my $useBlastn = 0;
 my $sequenceExt = "proteins";
+my $shardCount = 1;
+my $usePrefilter = 0;
+my $dbCacheDirectory;
+my $dbCacheSize;
+
+while ($ARGV[0] eq "-n" || $ARGV[0] eq "-shards" || $ARGV[0] eq "-prefilter" ||
+       $ARGV[0] eq "-dbcache")
+{
+  my $option = shift @ARGV;
+  if ($option eq "-n")
+  {
+    $sequenceExt = "nuc";
+    $useBlastn = 1;
+  }
+  elsif ($option eq "-prefilter")
+  {
+    $usePrefilter = 1;
+  }
+  elsif ($option eq "-dbcache")
+  {
+    $dbCacheDirectory = shift @ARGV;
+    $dbCacheSize = shift @ARGV;
+    if (!defined($dbCacheSize) || $dbCacheSize !~ /^[1-9][0-9]*$/)
+    {
+      die "-dbcache must be followed by a directory and a size in megabytes\n";
+    }
+  }
+  else
+  {
+    $shardCount = shift @ARGV;
+    if (!defined($shardCount) || $shardCount !~ /^[1-9][0-9]*$/)
+    {
+      die "-shards must be followed by a positive integer\n";
+    }
+  }
 
-if ($ARGV[0] eq "-n")
+  # the prefiltered BLASTs search a database built by mpiBlast for each
+  # block of queries, so there is no formatted database to shard or cache
+  if ($usePrefilter && $shardCount > 1)
+  {
+    die "-prefilter cannot be combined with -shards\n";
+  }
+  if ($usePrefilter && defined($dbCacheDirectory))
+  {
+    die "-prefilter cannot be combined with -dbcache\n";
+  }
+}
+
+if (@ARGV < 5)
 {
-  $sequenceExt = "nuc";
-  $useBlastn = 1;
-  shift @ARGV;
+  die "missing arguments after the options\n";
 }
 
 my $sequenceDirectory = shift @ARGV;
@@ -174,6 +285,188 @@ sub getHits
 }
 
 
+# Return the total length of the sequences in a FASTA file, and the number
+# of sequences.
+sub sequenceLength
+{
+  my $filename = $_[0];
+
+  open(LENGTH_INPUT, "<", $filename) or
+    die "cannot open input ($filename)\n";
+
+  my $length = 0;
+  my $count = 0;
+  while (my $line = <LENGTH_INPUT>)
+  {
+    if ($line =~ /^>/)
+    {
+      $count += 1;
+    }
+    else
+    {
+      $line =~ s/\s//g;
+      $length += length($line);
+    }
+  }
+  close(LENGTH_INPUT);
+
+  return ($length, $count);
+}
+
+# Split <db>.prepared into $shardCount shard files, <db>.prepared.shard<k>,
+# dealing out the sequences round-robin so the shards are about the same
+# size. (These are removed along with the formatted database files.)
+sub makeShards
+{
+  my $db = $_[0];
+
+  my @shards = ();
+  for (my $k = 0; $k < $shardCount; $k += 1)
+  {
+    open($shards[$k], ">", "$db.prepared.shard$k") or
+      die "cannot open output ($db.prepared.shard$k)\n";
+  }
+
+  open(SHARD_INPUT, "<", "$db.prepared") or
+    die "cannot open input ($db.prepared)\n";
+
+  my $sequenceCount = 0;
+  my $out;
+  while (my $line = <SHARD_INPUT>)
+  {
+    if ($line =~ /^>/)
+    {
+      $out = $shards[$sequenceCount % $shardCount];
+      $sequenceCount += 1;
+    }
+    if (!defined($out))
+    {
+      die "$db.prepared does not start with a FASTA header\n";
+    }
+    print $out $line;
+  }
+  close(SHARD_INPUT);
+
+  foreach my $shard (@shards)
+  {
+    close($shard);
+  }
+}
+
+# the version of makeblastdb, which is part of the key of each formatted
+# database (found when the first database is formatted)
+my $makeblastdbVersion;
+
+# the dbcache entries used by this run (see pruneDatabases)
+my %usedDbEntries = ();
+
+# Format <db>.prepared (or its shards) into the dbcache directory, unless
+# it is already there. Each formatted database has a directory of its own,
+# named by a hash of the sequences, the makeblastdb version and arguments,
+# and the number of shards, so a database is formatted only once, and is
+# formatted again if its sequences or the way it is formatted ever change.
+# Returns the name of the formatted database.
+sub formatDatabase
+{
+  my $db = $_[0];
+  my $dbType = $_[1];
+
+  my $makeblastdbArgs = "-dbtype $dbType";
+
+  if (!defined($makeblastdbVersion))
+  {
+    $makeblastdbVersion = `makeblastdb -version`;
+    if ($? != 0 || $makeblastdbVersion eq "")
+    {
+      die "cannot get the version of makeblastdb\n";
+    }
+  }
+
+  open(DIGEST_INPUT, "<", "$db.prepared") or
+    die "cannot open input ($db.prepared)\n";
+  binmode(DIGEST_INPUT);
+  my $digest = Digest::MD5->new;
+  $digest->addfile(*DIGEST_INPUT);
+  close(DIGEST_INPUT);
+  $digest->add("$makeblastdbVersion $makeblastdbArgs $shardCount");
+  my $entry = "dbcache/" . $digest->hexdigest;
+
+  if (! -d $entry)
+  {
+    # format under a temporary name, so a partial database is never used
+    my $tmp = "$entry.tmp" . POSIX::getpid();
+    mkdir("dbcache");
+    system "rm -rf $tmp";
+    mkdir($tmp) or
+      die "cannot create directory ($tmp)\n";
+
+    if ($shardCount > 1)
+    {
+      makeShards($db);
+      for (my $k = 0; $k < $shardCount; $k += 1)
+      {
+        system "makeblastdb $makeblastdbArgs -in $db.prepared.shard$k " .
+          "-out $tmp/$db.prepared.shard$k";
+
+        if($? != 0)
+        {
+            die("Could not format database shard $db.prepared.shard$k");
+        }
+      }
+    }
+    else
+    {
+      system "makeblastdb $makeblastdbArgs -in $db.prepared " .
+        "-out $tmp/$db.prepared";
+
+      if($? != 0)
+      {
+          die("Could not format database $db.prepared");
+      }
+    }
+
+    rename($tmp, $entry) or
+      die "rename of $tmp to $entry failed!";
+  }
+
+  $usedDbEntries{$entry} = 1;
+
+  return "$entry/$db.prepared";
+}
+
+# Remove the dbcache entries that this run did not use. Every genome is the
+# database of some BLAST of a run that adds genomes (each old genome is
+# searched by each new genome), so these are the databases of genomes whose
+# sequences have since changed, or that were formatted with another number
+# of shards or another makeblastdb. Nothing is removed if no database was
+# used (e.g. with -prefilter), or if another run is formatting one.
+sub pruneDatabases
+{
+  if (!%usedDbEntries)
+  {
+    return;
+  }
+
+  opendir(DBCACHE, "dbcache") or
+    die "cannot open directory (dbcache)\n";
+  my @entries = grep { !/^\./ } readdir(DBCACHE);
+  closedir(DBCACHE);
+
+  if (grep { /\.tmp/ } @entries)
+  {
+    return;
+  }
+
+  foreach my $name (@entries)
+  {
+    if (!defined($usedDbEntries{"dbcache/$name"}))
+    {
+      print "Removing unused formatted database dbcache/$name\n";
+      system "rm -rf dbcache/$name";
+    }
+  }
+}
+
 # This performs one BLAST operation between two genomes. The
 # first genome is the set of query genes and the two second genome acts
 # as the database to be searched. It produces two output files:
@@ -187,30 +480,68 @@ sub doOneBlast
 
   print "  Executing the BLASTs using MPI...\n";
 
-  # format the db
-  #system "formatdb -p -i $db.prepared";
   my $blastType;
+  my $dbType;
   if ($useBlastn)
   {
     $blastType = "blastn";
-    system "makeblastdb -dbtype nucl -in $db.prepared";
+    $dbType = "nucl";
   }
   else
   {
     $blastType = "blastp";
-    system "makeblastdb -dbtype prot -in $db.prepared";
+    $dbType = "prot";
   }
 
-  if($? != 0)
+  # if prefiltering, find the candidates, and tell mpiBlast about them and
+  # the length of the whole database (the database does not need to be
+  # formatted, since mpiBlast builds a small one for each block of queries)
+  # otherwise get the formatted db (if sharding, each shard is formatted,
+  # and mpiBlast is told about the shards and the length and number of
+  # sequences of the whole database)
+  my $dbArgs = "";
+  my $dbPath = "$db.prepared";
+  if ($usePrefilter)
   {
-      die("Could not format database $db.prepared");
+    my $nucleotideFlag = $useBlastn ? "-n " : "";
+    system "kmerPrefilter $nucleotideFlag$genome.prepared $db.prepared " .
+      "$genome-$db.candidates";
+
+    if($? != 0)
+    {
+        die("kmerPrefilter failed for $genome.prepared $db.prepared");
+    }
+
+    my ($dbLength, $dbCount) = sequenceLength("$db.prepared");
+    $dbArgs = "-candidates $genome-$db.candidates -dbsize $dbLength " .
+      "-dbseqs $dbCount ";
+  }
+  else
+  {
+    $dbPath = formatDatabase($db, $dbType);
+    if ($shardCount > 1)
+    {
+      my ($dbLength, $dbCount) = sequenceLength("$db.prepared");
+      $dbArgs = "-dbshards $shardCount -dbsize $dbLength -dbseqs $dbCount ";
+    }
+    if (defined($dbCacheDirectory))
+    {
+      $dbArgs .= "-dbcache $dbCacheDirectory -dbcachesize $dbCacheSize ";
+    }
+  }
+
+  # score without composition-based statistics, as selfScore does
+  if (!$useBlastn)
+  {
+    $dbArgs .= "-comp_based_stats 0 ";
   }
 
   # run mpiBlast (which takes two extra processes (scheduler and writer)
   # keep up to 500 blast hits
   # use output format 6
   my $actualProcessCount = $numberOfProcessors + 2;
-  system "mpiexec -n $actualProcessCount -f $tempMachinefile mpiBlast $blastType -query $genome.prepared -db $db.prepared -evalue $evalueThreshold -max_target_seqs 500 -outfmt 6 -out $genome-$db.temp 2>&1 </dev/null";
+  # gzip the output, which is read back below
+  system "mpiexec -n $actualProcessCount -f $tempMachinefile mpiBlast $blastType -query $genome.prepared -db $dbPath -evalue $evalueThreshold -max_target_seqs 500 -outfmt 6 ${dbArgs}-gzip -out $genome-$db.temp 2>&1 </dev/null";
 
   if($? != 0)
   {
@@ -225,11 +556,12 @@ sub doOneBlast
   open(OUTPUT_ERRORS, ">", "$genome-$db.errors") or
     die("Could not open blast output file $genome-$db.errors");
 
-  open (INPUT, "<", "$genome-$db.temp") or
-    die("Could not open temp file $genome-$db.temp");
+  # the temp file is a series of gzip members, one per block of queries
+  my $z = IO::Uncompress::Gunzip->new("$genome-$db.temp", MultiStream => 1) or
+    die("Could not open temp file $genome-$db.temp: $GunzipError");
 
-  my @outputLines = <INPUT>;
-  close INPUT;
+  my @outputLines = $z->getlines();
+  $z->close();
 
   my %sequenceHash = ();
 
@@ -319,7 +651,7 @@ sub doOneBlast
   close INPUT;
 
   # cleanup temp files
-  system "rm *.prepared.* *.temp";
+  system "rm -f *.prepared.* *.temp *.candidates";
 
 }
 
@@ -398,85 +730,66 @@ foreach my $old (@oldGenomes)
   }
   print "  $old.\n";
 }
-print "  Done.\n";
 
-# Now loop through each new genome and BLAST it against itself and create the
-# self-hit file and errors file.
-foreach my $new (@newGenomes)
+# the old genomes must have been scored the way the new ones will be
+my $scoring = $useBlastn ? "selfScore -n, blastn" :
+  "selfScore, blastp -comp_based_stats 0";
+if (@oldGenomes > 0)
 {
-  # count the genes in this genome
-  my $geneCount = 0;
-  open(IN, "<", "$new.prepared") or
-    die "cannot open input ($new.prepared)\n";
-  while (my $line = <IN>)
+  my $oldScoring = "self BLAST, composition-based statistics";
+  if (open(TMP, "<", "SCORING"))
   {
-    chomp($line);
-
-    if ($line =~ /^>/)
-    {
-      $geneCount += 1;
-    }
+    $oldScoring = <TMP>;
+    chomp($oldScoring);
+    close(TMP);
   }
-  close(IN);
-
-  # BLAST new x new
-  print "BLAST $new against itself...\n";
-  doOneBlast($new, $new);
-  print "  Done.\n";
-
-  # Read the error file produced by this BLAST into a hash
-  my %errorHash = readErrorsFile("$new-$new.errors");
-  my $bogusGenes = keys %errorHash;
-
-  # Find the self-hit and filter the BLAST results to remove hits to error genes
-  print "Finding the self-hits and the error genes...\n";
-  my $missingSelfHitCount = 0;
-  open(IN, "<", "$new-$new.blast") or
-    die "cannot open input ($new.blast)\n";
-  open(OUT, ">", "$new.self") or
-    die "cannot open output ($new.self)\n";
-  while (my $line = <IN>)
+  if ($oldScoring ne $scoring)
   {
-    chomp($line);
+    die "the genomes in DONE were scored by \"$oldScoring\", but new " .
+      "genomes are scored by \"$scoring\"; redo them all (from an " .
+      "empty DONE file) rather than mixing the two\n";
+  }
+}
+else
+{
+  open(TMP, ">", "SCORING") or
+    die "cannot open output (SCORING)\n";
+  print TMP "$scoring\n";
+  close(TMP);
+}
+print "  Done.\n";
 
-    # line contains the query gene first followed by the genes it hit
-    my @piece = split / /, $line;
+# Now compute the self-hit score of each gene of each new genome, which
+# creates the self-hit file and errors file.
+print "Computing the self-hits and finding the error genes...\n";
+foreach my $new (@newGenomes)
+{
+  my $nucleotideFlag = $useBlastn ? "-n " : "";
+  system "selfScore $nucleotideFlag$new.prepared $evalueThreshold " .
+    "$new.self $new.errors";
 
-    # grab the query gene
-    my $key = shift @piece;
+  if($? != 0)
+  {
+      die("selfScore failed for $new.prepared");
+  }
+}
+print "  Done.\n";
 
-    # sanity check: query gene should never be an error gene
-    if (defined($errorHash{$key}))
-    {
-      die "query gene ($key) is in error list?\n";
-    }
+# Filter the BLAST results of a query genome against a database genome to
+# remove the error genes of both genomes
+sub filterErrorGenes
+{
+  my $genome = $_[0];
+  my $db = $_[1];
 
-    # iterate through the hits to find self-hit
-    my $foundIt = 0;
-    for (my $i = 0; $i < @piece; $i += 1)
-    {
-      my @datum = split /!/, $piece[$i];
-      if ($datum[0] eq $key)
-      {
-        print OUT "$key $datum[1]\n";
-        $foundIt = 1;
-      }
-    }
-    # if no self-hit, then add it to the error hash
-    if ($foundIt == 0)
-    {
-      $missingSelfHitCount += 1;
-      $errorHash{$key} = $key;
-    }
-  }
-  close(IN);
-  close(OUT);
+  # read in error genes for both genomes
+  my %errorHash = readErrorsFile("$genome.errors");
+  my %otherErrorHash = readErrorsFile("$db.errors");
 
-  # Filter the BLAST results to remove error genes
-  open(IN, "<", "$new-$new.blast") or
-    die "cannot open input ($new-$new.blast)\n";
-  open(OUT, ">", "$new-$new.tmp") or
-    die "cannot open output ($new-$new.tmp)\n";
+  open(IN, "<", "$genome-$db.blast") or
+    die "cannot open input ($genome-$db.blast)\n";
+  open(OUT, ">", "$genome-$db.tmp") or
+    die "cannot open output ($genome-$db.tmp)\n";
   while (my $line = <IN>)
   {
     chomp($line);
@@ -488,7 +801,7 @@ foreach my $new (@newGenomes)
     my $key = shift @piece;
     if (defined($errorHash{$key}))
     {
-      next;  # skip if the query gene is on the error list (missing self-hit)
+      next;  # skip if the query gene is on the error list
     }
     else
     {
@@ -499,7 +812,7 @@ foreach my $new (@newGenomes)
     for (my $i = 0; $i < @piece; $i += 1)
     {
       my @datum = split /!/, $piece[$i];
-      if (defined($errorHash{$datum[0]}))
+      if (defined($otherErrorHash{$datum[0]}))
       {
         next;  # skip if the subject gene is on the error list
       }
@@ -514,241 +827,53 @@ foreach my $new (@newGenomes)
   close(OUT);
 
   # rename filtered tmp file to be the BLAST result file
-  rename("$new-$new.tmp", "$new-$new.blast") or
-    die "rename of $new-$new.tmp to $new-$new.blast failed!";
-
-  # dump error hash to a file
-  my $errorCount = 0;
-  open(OUT, ">", "$new.errors") or
-    die "cannot open output ($new.errors)\n";
-  foreach my $gene (keys %errorHash)
-  {
-    print OUT "$gene\n";
-    $errorCount += 1;
-  }
-  close(OUT);
-  print "  $errorCount ($bogusGenes + $missingSelfHitCount) errors in " .
-           "$geneCount genes ";
-  my $percent = ($errorCount / $geneCount) * 100;
-  printf "(%.1f%%)\n", $percent;
-
-  # can remove the errors file produced by the BLAST
-  unlink ("$new-$new.errors") or
-    die "delete of $new-$new.errors failed!";
-
-  print "  Done.\n";
+  rename ("$genome-$db.tmp", "$genome-$db.blast") or
+    die "rename of $genome-$db.tmp to $genome-$db.blast failed!";
 }
 
-# Now loop through each new genome and BLAST it against the other new genomes.
+# Now do all the BLASTs that involve a new genome: each new genome against
+# itself and the other new genomes, and each new genome against each old
+# genome and vice versa. Since the self-hits no longer come from BLAST,
+# these are all independent of each other. They are still done one at a
+# time, as one mpiBlast run per pair, each using all the processors of the
+# machinefile (so the processors sit idle while each run starts up and
+# while its last blocks finish).
+my @pairs = ();
 foreach my $new (@newGenomes)
 {
-  # read the new genome's error file into a hash
-  my %errorHash = readErrorsFile("$new.errors");
-
   foreach my $otherNew (@newGenomes)
   {
-    if ($new eq $otherNew)
-    {
-      next;
-    }
-
-    print "BLAST $new against $otherNew...\n";
-    doOneBlast($new, $otherNew);
-    print "  Done.\n";
-
-    # the error file produced by this step can be discarded
-    unlink "$new-$otherNew.errors" or
-      die "cannot delete $new-$otherNew.errors";
-
-    print "Filtering error genes from the BLAST results...\n";
-
-    # read in error genes for other new genome
-    my %otherErrorHash = readErrorsFile("$otherNew.errors");
-
-    open(IN, "<", "$new-$otherNew.blast") or
-      die "cannot open input ($new-$otherNew.blast)\n";
-    open(OUT, ">", "$new-$otherNew.tmp") or
-      die "cannot open output ($new-$otherNew.tmp)\n";
-    while (my $line = <IN>)
-    {
-      chomp($line);
-
-      # line contains the query gene first followed by the genes it hit
-      my @piece = split / /, $line;
-
-      # grab the query gene
-      my $key = shift @piece;
-      if (defined($errorHash{$key}))
-      {
-        next;  # skip if the query gene is on the error list
-      }
-      else
-      {
-        print OUT "$key";
-      }
-
-      # iterate through the hits to filter out errors
-      for (my $i = 0; $i < @piece; $i += 1)
-      {
-        my @datum = split /!/, $piece[$i];
-        if (defined($otherErrorHash{$datum[0]}))
-        {
-          next;  # skip if the subject gene is on the error list
-        }
-        else
-        {
-          print OUT " $piece[$i]";
-        }
-      }
-      print OUT "\n";
-    }
-    close(IN);
-    close(OUT);
-
-    # rename filtered tmp file to be the BLAST result file
-    rename ("$new-$otherNew.tmp", "$new-$otherNew.blast") or
-      die "rename of $new-$otherNew.tmp to $new-$otherNew.blast failed!";
-
-    print "  Done.\n";
+    push @pairs, [$new, $otherNew];
   }
-}
-
-# Now loop through each new genome and BLAST it against each old genome
-foreach my $new (@newGenomes)
-{
-  # read in error genes for new genome
-  my %errorHash = readErrorsFile("$new.errors");
-
   foreach my $old (@oldGenomes)
   {
-    print "BLAST $new against $old...\n";
-    doOneBlast($new, $old);
-    print "  Done.\n";
-
-    # the error file produced by this step can be discarded
-    unlink "$new-$old.errors" or
-      die "cannot delete $new-$old.errors";
-
-    print "Filtering error genes from the BLAST results...\n";
-
-    # read in error genes for old genome
-    my %otherErrorHash = readErrorsFile("$old.errors");
-
-    open(IN, "<", "$new-$old.blast") or
-      die "cannot open input ($new-$old.blast)\n";
-    open(OUT, ">", "$new-$old.tmp") or
-      die "cannot open output ($new-$old.tmp)\n";
-    while (my $line = <IN>)
-    {
-      chomp($line);
-
-      # line contains the query gene first followed by the genes it hit
-      my @piece = split / /, $line;
-
-      # grab the query gene
-      my $key = shift @piece;
-      if (defined($errorHash{$key}))
-      {
-        next;  # skip if the query gene is on the error list
-      }
-      else
-      {
-        print OUT "$key";
-      }
-
-      # iterate through the hits to filter out errors
-      for (my $i = 0; $i < @piece; $i += 1)
-      {
-        my @datum = split /!/, $piece[$i];
-        if (defined($otherErrorHash{$datum[0]}))
-        {
-          next;  # skip if the subject gene is on the error list
-        }
-        else
-        {
-          print OUT " $piece[$i]";
-        }
-      }
-      print OUT "\n";
-    }
-    close(IN);
-    close(OUT);
-
-    # rename filtered tmp file to be the BLAST result file
-    rename ("$new-$old.tmp", "$new-$old.blast") or
-      die "rename of $new-$old.tmp to $new-$old.blast failed!";
-
-    print "  Done.\n";
+    push @pairs, [$new, $old];
+    push @pairs, [$old, $new];
   }
 }
 
-# Now loop through each new genome and BLAST each old genome against it
-foreach my $new (@newGenomes)
+foreach my $pair (@pairs)
 {
-  # read in error genes for new genome
-  my %errorHash = readErrorsFile("$new.errors");
+  my ($genome, $db) = @$pair;
 
-  foreach my $old (@oldGenomes)
+  if ($genome eq $db)
   {
-    print "BLAST $old against $new...\n";
-    doOneBlast($old, $new);
-    print "  Done.\n";
-
-    # the error file produced by this step can be discarded
-    unlink "$old-$new.errors" or
-      die "cannot delete $old-$new.errors";
-
-    print "Filtering error genes from the BLAST results...\n";
-
-    # read in error genes for other new genome
-    my %otherErrorHash = readErrorsFile("$old.errors");
-
-    open(IN, "<", "$old-$new.blast") or
-      die "cannot open input ($old-$new.blast)\n";
-    open(OUT, ">", "$old-$new.tmp") or
-      die "cannot open output ($old-$new.tmp)\n";
-    while (my $line = <IN>)
-    {
-      chomp($line);
-
-      # line contains the query gene first followed by the genes it hit
-      my @piece = split / /, $line;
-
-      # grab the query gene
-      my $key = shift @piece;
-      if (defined($otherErrorHash{$key}))
-      {
-        next;  # skip if the query gene is on the error list
-      }
-      else
-      {
-        print OUT "$key";
-      }
-
-      # iterate through the hits to filter out errors
-      for (my $i = 0; $i < @piece; $i += 1)
-      {
-        my @datum = split /!/, $piece[$i];
-        if (defined($errorHash{$datum[0]}))
-        {
-          next;  # skip if the subject gene is on the error list
-        }
-        else
-        {
-          print OUT " $piece[$i]";
-        }
-      }
-      print OUT "\n";
-    }
-    close(IN);
-    close(OUT);
+    print "BLAST $genome against itself...\n";
+  }
+  else
+  {
+    print "BLAST $genome against $db...\n";
+  }
+  doOneBlast($genome, $db);
+  print "  Done.\n";
 
-    # rename filtered tmp file to be the BLAST result file
-    rename ("$old-$new.tmp", "$old-$new.blast") or
-      die "rename of $old-$new.tmp to $old-$new.blast failed!";
+  # the error file produced by this step can be discarded
+  unlink "$genome-$db.errors" or
+    die "cannot delete $genome-$db.errors";
 
-    print "  Done.\n";
-  }
+  print "Filtering error genes from the BLAST results...\n";
+  filterErrorGenes($genome, $db);
+  print "  Done.\n";
 }
 
 # Finally, update the DONE file
@@ -760,6 +885,8 @@ foreach my $new (@newGenomes)
 }
 close(OUT);
 
+pruneDatabases();
+
 # clean up copy of the machinefile
 $tempMachinefile = "tmp-" . getpid() . "-mf";
 my $rmErr = system "rm $tempMachinefile";
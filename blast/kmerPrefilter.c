@@ -0,0 +1,564 @@
+/*
+ * $Id$
+ *
+ * Find, for each query sequence, the database sequences that are worth
+ * BLAST-ing it against.
+ *
+ * The Lerat analysis only keeps hits whose bit score is a large fraction of
+ * the query's self-hit bit score, and pairs of genes that score that well
+ * share many short words. So the database is indexed by a spaced seed over
+ * a reduced amino acid alphabet, and a database sequence becomes a
+ * candidate for a query when they share at least a minimum number of
+ * distinct seed words. The candidates are written one line per query, the
+ * query name followed by the candidate names, separated by spaces, which
+ * is the form mpiBlast expects for its -candidates argument.
+ *
+ * Usage: kmerPrefilter [-n] [-seed pattern] [-minhits count]
+ *          [-threads count] queryFile dbFile outputFile
+ *
+ *   -n       the sequences are nucleotides (the default is proteins)
+ *   -seed    the spaced seed, as a string of 1's (positions that must
+ *            match) and 0's (positions that are ignored)
+ *   -minhits number of distinct seed words that must be shared
+ *   -threads number of threads used to process the queries
+ *
+ * The input files are FASTA files, and the sequence name is the text
+ * between the > and the first white space of the header.
+ *
+ * This must be compiled with -pthread.
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+
+// default spaced seeds for proteins and nucleotides
+#define PROTEIN_SEED "1101101101"
+#define NUCLEOTIDE_SEED "11011011011"
+
+#define DEFAULT_MIN_HITS 3
+#define DEFAULT_THREADS 4
+
+// reduced alphabet size for proteins (see the table in initAlphabet)
+#define PROTEIN_ALPHABET 10
+#define NUCLEOTIDE_ALPHABET 4
+
+// the largest number of seed words that will be indexed
+#define MAX_BUCKETS (1 << 26)
+
+/*
+ * A set of sequences read from a FASTA file.
+ */
+typedef struct
+{
+    int count;
+    char **names;
+    char **residues;
+    int *lengths;
+} SequenceSet;
+
+/*
+ * What each thread needs to process its share of the queries.
+ */
+typedef struct
+{
+    int first;             // the thread does queries first, first+step, ...
+    int step;
+    SequenceSet *queries;
+    SequenceSet *db;
+    int *bucketStart;      // the subjects for bucket b are bucketSubjects[i]
+    int *bucketSubjects;   //   for bucketStart[b] <= i < bucketStart[b+1]
+    char **results;        // candidate line for each query
+} ThreadArgs;
+
+// maps a residue to its letter in the reduced alphabet, or -1 if the
+// residue is not indexed (e.g. X)
+static int alphabet[256];
+static int alphabetSize;
+
+// positions of the 1's in the seed
+static int seedOffsets[64];
+static int seedWeight;
+static int seedSpan;
+
+static int numberOfBuckets;
+static int minHits = DEFAULT_MIN_HITS;
+
+/*
+ * Called upon a fatal error
+ */
+void fatal(char *message)
+{
+    fprintf(stderr, "%s\n", message);
+    exit(-1);
+}
+
+void usageMessage(void)
+{
+    fprintf(stderr,
+      "Usage: kmerPrefilter [-n] [-seed pattern] [-minhits count] "
+      "[-threads count] queryFile dbFile outputFile\n");
+    exit(1);
+}
+
+/*
+ * Set up the reduced alphabet. For proteins this is the 10 letter
+ * alphabet of Murphy et al. (Protein Eng. 2000), which groups residues
+ * that commonly substitute for each other, so that seeds still match
+ * across conservative substitutions.
+ */
+void initAlphabet(int nucleotides)
+{
+    int i;
+    for (i = 0; i < 256; i++) alphabet[i] = -1;
+
+    if (nucleotides)
+    {
+        const char *letters = "ACGT";
+        for (i = 0; i < 4; i++)
+        {
+            alphabet[(int) letters[i]] = i;
+            alphabet[tolower(letters[i])] = i;
+        }
+        alphabetSize = NUCLEOTIDE_ALPHABET;
+    }
+    else
+    {
+        const char *groups[PROTEIN_ALPHABET] =
+          { "LVIM", "C", "A", "G", "ST", "P", "FYW", "EDNQ", "KR", "H" };
+        for (i = 0; i < PROTEIN_ALPHABET; i++)
+        {
+            const char *p;
+            for (p = groups[i]; *p != 0; p++)
+            {
+                alphabet[(int) *p] = i;
+                alphabet[tolower(*p)] = i;
+            }
+        }
+        alphabetSize = PROTEIN_ALPHABET;
+    }
+}
+
+/*
+ * Parse the seed pattern and work out the number of buckets in the index.
+ */
+void initSeed(const char *pattern)
+{
+    int i;
+
+    seedWeight = 0;
+    seedSpan = strlen(pattern);
+    if (seedSpan > 64) fatal("seed is too long");
+    for (i = 0; i < seedSpan; i++)
+    {
+        if (pattern[i] == '1')
+        {
+            seedOffsets[seedWeight] = i;
+            seedWeight += 1;
+        }
+        else if (pattern[i] != '0')
+        {
+            fatal("seed must contain only 0's and 1's");
+        }
+    }
+    if (seedWeight == 0 || pattern[0] != '1' || pattern[seedSpan-1] != '1')
+    {
+        fatal("seed must start and end with a 1");
+    }
+
+    long long buckets = 1;
+    for (i = 0; i < seedWeight; i++)
+    {
+        buckets *= alphabetSize;
+        if (buckets > MAX_BUCKETS) fatal("seed has too many 1's");
+    }
+    numberOfBuckets = buckets;
+}
+
+/*
+ * Return the bucket for the seed word starting at position pos of seq,
+ * or -1 if the word contains a residue that is not indexed.
+ */
+static inline int seedBucket(const char *seq, int pos)
+{
+    int bucket = 0;
+    int i;
+    for (i = 0; i < seedWeight; i++)
+    {
+        int letter = alphabet[(unsigned char) seq[pos + seedOffsets[i]]];
+        if (letter < 0) return -1;
+        bucket = bucket * alphabetSize + letter;
+    }
+    return bucket;
+}
+
+/*
+ * Read all the sequences in a FASTA file.
+ */
+void readSequences(const char *filename, SequenceSet *set)
+{
+    FILE *fp = fopen(filename, "r");
+    if (fp == NULL)
+    {
+        fprintf(stderr, "cannot open input (%s)\n", filename);
+        exit(EXIT_FAILURE);
+    }
+
+    int allocCount = 1024;
+    set->count = 0;
+    set->names = malloc(sizeof(char *) * allocCount);
+    set->residues = malloc(sizeof(char *) * allocCount);
+    set->lengths = malloc(sizeof(int) * allocCount);
+    if (set->names == NULL || set->residues == NULL || set->lengths == NULL)
+    {
+        fatal("readSequences: malloc failed");
+    }
+
+    int seqAlloc = 0;
+    char *line = NULL;
+    size_t lineAlloc = 0;
+    ssize_t n;
+    while ((n = getline(&line, &lineAlloc, fp)) != -1)
+    {
+        if (line[0] == '>')
+        {
+            if (set->count == allocCount)
+            {
+                allocCount *= 2;
+                set->names = realloc(set->names, sizeof(char *) * allocCount);
+                set->residues = realloc(set->residues,
+                  sizeof(char *) * allocCount);
+                set->lengths = realloc(set->lengths, sizeof(int) * allocCount);
+                if (set->names == NULL || set->residues == NULL ||
+                  set->lengths == NULL)
+                {
+                    fatal("readSequences: realloc failed");
+                }
+            }
+
+            // the name is everything up to the first white space
+            char *start = line + 1;
+            while (*start == ' ' || *start == '\t') start++;
+            int len = strcspn(start, " \t\r\n");
+            set->names[set->count] = strndup(start, len);
+
+            seqAlloc = 1024;
+            set->residues[set->count] = malloc(seqAlloc);
+            if (set->residues[set->count] == NULL)
+            {
+                fatal("readSequences: malloc failed");
+            }
+            set->residues[set->count][0] = 0;
+            set->lengths[set->count] = 0;
+            set->count += 1;
+        }
+        else
+        {
+            if (set->count == 0)
+            {
+                fprintf(stderr, "%s does not start with a FASTA header\n",
+                  filename);
+                exit(EXIT_FAILURE);
+            }
+            int s = set->count - 1;
+            int i;
+            for (i = 0; i < n; i++)
+            {
+                if (isspace((unsigned char) line[i])) continue;
+                if (set->lengths[s] + 2 > seqAlloc)
+                {
+                    seqAlloc *= 2;
+                    set->residues[s] = realloc(set->residues[s], seqAlloc);
+                    if (set->residues[s] == NULL)
+                    {
+                        fatal("readSequences: realloc failed");
+                    }
+                }
+                set->residues[s][set->lengths[s]] = line[i];
+                set->lengths[s] += 1;
+            }
+            set->residues[s][set->lengths[s]] = 0;
+        }
+    }
+    free(line);
+    fclose(fp);
+}
+
+/*
+ * Build the index of the database: for each bucket, the list of database
+ * sequences that contain that seed word (each listed only once).
+ */
+void buildIndex(SequenceSet *db, int **bucketStartOut,
+  int **bucketSubjectsOut)
+{
+    int *bucketStart = calloc(numberOfBuckets + 1, sizeof(int));
+    int *lastSubject = malloc(sizeof(int) * numberOfBuckets);
+    if (bucketStart == NULL || lastSubject == NULL)
+    {
+        fatal("buildIndex: malloc failed");
+    }
+
+    int b, s, pos;
+
+    // first pass: count the subjects in each bucket
+    for (b = 0; b < numberOfBuckets; b++) lastSubject[b] = -1;
+    for (s = 0; s < db->count; s++)
+    {
+        for (pos = 0; pos + seedSpan <= db->lengths[s]; pos++)
+        {
+            b = seedBucket(db->residues[s], pos);
+            if (b >= 0 && lastSubject[b] != s)
+            {
+                lastSubject[b] = s;
+                bucketStart[b + 1] += 1;
+            }
+        }
+    }
+    for (b = 0; b < numberOfBuckets; b++)
+    {
+        bucketStart[b + 1] += bucketStart[b];
+    }
+
+    // second pass: fill in the subjects
+    int *bucketSubjects =
+      malloc(sizeof(int) * (bucketStart[numberOfBuckets] + 1));
+    int *fill = malloc(sizeof(int) * numberOfBuckets);
+    if (bucketSubjects == NULL || fill == NULL)
+    {
+        fatal("buildIndex: malloc failed");
+    }
+    memcpy(fill, bucketStart, sizeof(int) * numberOfBuckets);
+    for (b = 0; b < numberOfBuckets; b++) lastSubject[b] = -1;
+    for (s = 0; s < db->count; s++)
+    {
+        for (pos = 0; pos + seedSpan <= db->lengths[s]; pos++)
+        {
+            b = seedBucket(db->residues[s], pos);
+            if (b >= 0 && lastSubject[b] != s)
+            {
+                lastSubject[b] = s;
+                bucketSubjects[fill[b]] = s;
+                fill[b] += 1;
+            }
+        }
+    }
+
+    free(fill);
+    free(lastSubject);
+
+    *bucketStartOut = bucketStart;
+    *bucketSubjectsOut = bucketSubjects;
+}
+
+/*
+ * Append a string to a growable string.
+ */
+void appendString(char **text, int *length, int *allocSize, const char *s)
+{
+    int n = strlen(s);
+    while (*length + n + 1 > *allocSize)
+    {
+        *allocSize *= 2;
+        *text = realloc(*text, *allocSize);
+        if (*text == NULL) fatal("appendString: realloc failed");
+    }
+    memcpy(*text + *length, s, n + 1);
+    *length += n;
+}
+
+/*
+ * Thread body: find the candidates for a share of the queries.
+ */
+void *findCandidates(void *arg)
+{
+    ThreadArgs *args = arg;
+    SequenceSet *queries = args->queries;
+    SequenceSet *db = args->db;
+
+    // number of distinct seed words each subject shares with the query
+    int *counts = calloc(db->count, sizeof(int));
+
+    // subjects with a non-zero count, so counts can be cleared quickly
+    int *touched = malloc(sizeof(int) * (db->count + 1));
+
+    // the last query that looked up each bucket, so that a seed word that
+    // occurs more than once in a query is only counted once
+    int *lastQuery = malloc(sizeof(int) * numberOfBuckets);
+
+    if (counts == NULL || touched == NULL || lastQuery == NULL)
+    {
+        fatal("findCandidates: malloc failed");
+    }
+
+    int b, q;
+    for (b = 0; b < numberOfBuckets; b++) lastQuery[b] = -1;
+
+    for (q = args->first; q < queries->count; q += args->step)
+    {
+        int touchedCount = 0;
+        int pos;
+
+        for (pos = 0; pos + seedSpan <= queries->lengths[q]; pos++)
+        {
+            b = seedBucket(queries->residues[q], pos);
+            if (b < 0 || lastQuery[b] == q) continue;
+            lastQuery[b] = q;
+
+            int i;
+            for (i = args->bucketStart[b]; i < args->bucketStart[b + 1]; i++)
+            {
+                int s = args->bucketSubjects[i];
+                if (counts[s] == 0)
+                {
+                    touched[touchedCount] = s;
+                    touchedCount += 1;
+                }
+                counts[s] += 1;
+            }
+        }
+
+        // build the output line for this query
+        int allocSize = 256;
+        int length = 0;
+        char *result = malloc(allocSize);
+        if (result == NULL) fatal("findCandidates: malloc failed");
+        result[0] = 0;
+        appendString(&result, &length, &allocSize, queries->names[q]);
+
+        int i;
+        for (i = 0; i < touchedCount; i++)
+        {
+            int s = touched[i];
+            if (counts[s] >= minHits)
+            {
+                appendString(&result, &length, &allocSize, " ");
+                appendString(&result, &length, &allocSize, db->names[s]);
+            }
+            counts[s] = 0;
+        }
+        appendString(&result, &length, &allocSize, "\n");
+
+        args->results[q] = result;
+    }
+
+    free(counts);
+    free(touched);
+    free(lastQuery);
+
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    int nucleotides = 0;
+    int threadCount = DEFAULT_THREADS;
+    char *seed = NULL;
+
+    int i = 1;
+    while (i < argc && argv[i][0] == '-')
+    {
+        if (!strcmp(argv[i], "-n"))
+        {
+            nucleotides = 1;
+            i += 1;
+        }
+        else if (!strcmp(argv[i], "-seed") && i + 1 < argc)
+        {
+            seed = argv[i+1];
+            i += 2;
+        }
+        else if (!strcmp(argv[i], "-minhits") && i + 1 < argc)
+        {
+            minHits = atoi(argv[i+1]);
+            if (minHits < 1) usageMessage();
+            i += 2;
+        }
+        else if (!strcmp(argv[i], "-threads") && i + 1 < argc)
+        {
+            threadCount = atoi(argv[i+1]);
+            if (threadCount < 1) usageMessage();
+            i += 2;
+        }
+        else
+        {
+            usageMessage();
+        }
+    }
+    if (argc - i != 3) usageMessage();
+
+    char *queryFileName = argv[i];
+    char *dbFileName = argv[i+1];
+    char *outFileName = argv[i+2];
+
+    if (seed == NULL) seed = nucleotides ? NUCLEOTIDE_SEED : PROTEIN_SEED;
+
+    initAlphabet(nucleotides);
+    initSeed(seed);
+
+    SequenceSet queries;
+    SequenceSet db;
+    readSequences(queryFileName, &queries);
+    readSequences(dbFileName, &db);
+
+    int *bucketStart;
+    int *bucketSubjects;
+    buildIndex(&db, &bucketStart, &bucketSubjects);
+
+    char **results = malloc(sizeof(char *) * (queries.count + 1));
+    pthread_t *tids = malloc(sizeof(pthread_t) * threadCount);
+    ThreadArgs *args = malloc(sizeof(ThreadArgs) * threadCount);
+    if (results == NULL || tids == NULL || args == NULL)
+    {
+        fatal("main: malloc failed");
+    }
+
+    // the queries are dealt out round-robin to the threads
+    int t;
+    for (t = 0; t < threadCount; t++)
+    {
+        args[t].first = t;
+        args[t].step = threadCount;
+        args[t].queries = &queries;
+        args[t].db = &db;
+        args[t].bucketStart = bucketStart;
+        args[t].bucketSubjects = bucketSubjects;
+        args[t].results = results;
+        if (pthread_create(&tids[t], NULL, findCandidates, &args[t]) != 0)
+        {
+            fatal("main: pthread_create failed");
+        }
+    }
+    for (t = 0; t < threadCount; t++)
+    {
+        pthread_join(tids[t], NULL);
+    }
+
+    // write the candidates, in query order
+    FILE *fp = fopen(outFileName, "w");
+    if (fp == NULL)
+    {
+        fprintf(stderr, "cannot open output (%s)\n", outFileName);
+        exit(EXIT_FAILURE);
+    }
+    long long candidateCount = 0;
+    for (i = 0; i < queries.count; i++)
+    {
+        const char *p;
+        for (p = results[i]; *p != 0; p++)
+        {
+            if (*p == ' ') candidateCount += 1;
+        }
+        fputs(results[i], fp);
+        free(results[i]);
+    }
+    if (fclose(fp) != 0) fatal("main: write of output failed");
+
+    fprintf(stderr, "%d queries, %d database sequences, %lld candidate pairs "
+      "(%.2f%% of all pairs)\n", queries.count, db.count, candidateCount,
+      (queries.count > 0 && db.count > 0) ?
+      100.0 * candidateCount / ((double) queries.count * db.count) : 0.0);
+
+    return 0;
+}
@@ -23,6 +23,38 @@
  *               other purposes than doPairwiseBlasts. in doing this got
  *               rid of the optional number-of-queries argument, which was
  *               not being used anyway.
+ *
+ * agent Oct 2026: added the optional -gzip argument. When given, each worker
+ *               compresses the output of each blast invocation into its own
+ *               gzip member before sending it to the writer, and the writer
+ *               simply appends those members to the output file. The
+ *               concatenation is a valid gzip file (gzip -dc reads it).
+ *               The optional -frameindex argument names a file where the
+ *               writer records, for each member, its byte offset and
+ *               compressed length in the output file, followed by its
+ *               uncompressed length. Each member holds the complete output
+ *               for a block of queries, so members can be decompressed
+ *               independently and in parallel. Must now be linked with -lz.
+ *
+ * agent Oct 2026: added the optional -dbshards argument for databases that
+ *               have been split into shards. The scheduler hands out
+ *               (query block, shard) tasks and the writer merges the hits
+ *               for each query across the shards, keeping the best
+ *               -max_target_seqs subjects by bit score. Also fixed the
+ *               worker reading a full BUFFER_SIZE from blast and then
+ *               writing the terminating null past the end of the buffer.
+ *
+ * agent Oct 2026: added the optional -candidates argument so each block of
+ *               queries is searched only against the database sequences
+ *               that kmerPrefilter found to be worth searching.
+ *
+ * agent Oct 2026: added the optional -dbcache and -dbcachesize arguments so
+ *               the workers search a copy of the database in node-local
+ *               storage, which is kept for later runs on the same node.
+ *
+ * agent Oct 2026: with -dbshards or -candidates the workers now recompute
+ *               the e-values for the whole database, which needs the new
+ *               -dbseqs argument. Must now also be linked with -lm.
  */
 
 #include <pthread.h>
@@ -36,6 +68,13 @@
 #include <time.h>
 #include <sys/time.h>
 #include <errno.h>
+#include <zlib.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <math.h>
 
 //#define DEBUG
 
@@ -57,6 +96,30 @@
 #define BLOCK_SIZE 20000
 #endif
 
+// agent Oct 2026: compression level used by the workers when -gzip is given
+#ifndef GZIP_LEVEL
+#define GZIP_LEVEL 6
+#endif
+
+// agent Oct 2026: number of helper threads the writer uses to merge and
+// compress the output of the shards, and the number of blocks that may
+// wait for them
+#ifndef WRITER_THREADS
+#define WRITER_THREADS 2
+#endif
+#define MAX_QUEUED_FRAMES (4 * WRITER_THREADS)
+
+// agent Oct 2026: default size limit of the -dbcache cache, in megabytes
+#ifndef DB_CACHE_SIZE
+#define DB_CACHE_SIZE 4096
+#endif
+
+// agent Oct 2026: factor by which -evalue is relaxed for blast when it
+// searches part of the database (-dbshards or -candidates)
+#ifndef EVALUE_SLACK
+#define EVALUE_SLACK 100
+#endif
+
 /*
  * Called upon a fatal error
  *
@@ -195,7 +258,7 @@ char* buildNewString(FILE *fp, int *amountRead)
     // has the end of the block been reached?
     // (the +2 is for a newline and then the null on the end)
     // (this is a loop because may need to repeatedly resize)
-    while ((strlen(finalString) + strlen(buf) + 2) > allocSize)
+    while ((strlen(finalString) + strlen(buf) + 2) > (size_t) allocSize)
     {
 #ifdef DEBUG
       fprintf(stderr, "buildNewString: beyond block size\n");
@@ -270,9 +333,13 @@ char* buildNewString(FILE *fp, int *amountRead)
  *
  * filename - path to read queries from
  * size     - number of workers
+ * shardCount - number of database shards
  *
+ * agent Oct 2026: each block of queries is now sent out once per database
+ * shard before the next block is read. The begin message tells the worker
+ * which block and which shard it is searching.
  */
-void scheduler(char* filename, int size)
+void scheduler(char* filename, int size, int shardCount)
 {
 #ifdef DEBUG
     fprintf(stderr, "scheduler started\n");
@@ -287,7 +354,15 @@ void scheduler(char* filename, int size)
     MPI_Status status;
 
     //toSend contains the entire outgoing message
-    char *toSend;
+    char *toSend = NULL;
+
+    //number of the block in toSend and how many shards it has been sent for
+    //(starting shardsSent at shardCount forces the first block to be read)
+    int blockNumber = -1;
+    int shardsSent = shardCount;
+
+    //begin message giving the block and shard numbers
+    char beginMessage[32];
   
     //outgoing messages will be placed in this buffer
     char *buffer;
@@ -322,8 +397,15 @@ void scheduler(char* filename, int size)
         //get sender of the message
         int sender = status.MPI_SOURCE;
 
-        //build a new query string to send to the worker
-        toSend = buildNewString(fp, &queriesRead);
+        //build a new query string to send to the worker, once the current
+        //one has been sent for every shard
+        if (shardsSent == shardCount)
+        {
+            if (toSend != NULL) free(toSend);
+            toSend = buildNewString(fp, &queriesRead);
+            blockNumber++;
+            shardsSent = 0;
+        }
       
         //if no more queries, send complete message
         if(toSend == NULL)
@@ -349,7 +431,10 @@ void scheduler(char* filename, int size)
             fprintf(stderr, "scheduler sending begin message\n");
 #endif
             //send begin message tag
-            MPI_Send("", 1, MPI_CHAR, sender, BEGIN_TAG, MPI_COMM_WORLD);
+            snprintf(beginMessage, sizeof(beginMessage), "%d %d",
+              blockNumber, shardsSent);
+            MPI_Send(beginMessage, strlen(beginMessage) + 1, MPI_CHAR, sender,
+              BEGIN_TAG, MPI_COMM_WORLD);
       
             //send message
             while (cntSent < messageLength)
@@ -385,7 +470,7 @@ void scheduler(char* filename, int size)
             //send end message tag
             MPI_Send("", 1, MPI_CHAR, sender, END_TAG, MPI_COMM_WORLD);  
     
-            free(toSend);
+            shardsSent++;
         }
     }
 
@@ -396,13 +481,451 @@ void scheduler(char* filename, int size)
     MPI_Send("", 1, MPI_CHAR, WRITER_PROCESS, COMPLETE_TAG, MPI_COMM_WORLD);
 }
 
+/*
+ * agent Oct 2026: the support below is used by the writer when the database
+ * has been split into shards. Each block of queries is then searched once
+ * per shard, and the writer must merge the hits for each query across the
+ * shards before writing them.
+ */
+
+/*
+ * A block of queries whose results are still arriving from the shards.
+ */
+typedef struct
+{
+    char **shardText;     // blast output for each shard (NULL until received)
+    int shardsReceived;
+} PendingBlock;
+
+/*
+ * One line of tabular (-outfmt 6) blast output.
+ */
+typedef struct
+{
+    char *line;           // the line itself, NULL terminated
+    char *subject;        // start of the subject field within line
+    int subjectLength;
+    int query;            // position of the query in the merged output
+    int order;            // position of the line in the combined shard output
+    double bitScore;
+    double bestBitScore;  // best bit score of any line for query and subject
+} HitLine;
+
+/*
+ * Append n bytes of data to a growable string.
+ */
+void appendText(char **text, size_t *length, size_t *allocSize,
+  const char *data, size_t n)
+{
+    if (*length + n + 1 > *allocSize)
+    {
+        size_t newSize = (*allocSize == 0) ? BUFFER_SIZE : *allocSize;
+        while (*length + n + 1 > newSize) newSize *= 2;
+        *text = realloc(*text, newSize);
+        if (*text == NULL) fatal("appendText: realloc failed");
+        *allocSize = newSize;
+    }
+    memcpy(*text + *length, data, n);
+    *length += n;
+    (*text)[*length] = 0;
+}
+
+/*
+ * Compare two fields that are not NULL terminated.
+ */
+int compareFields(const char *a, int aLength, const char *b, int bLength)
+{
+    int n = (aLength < bLength) ? aLength : bLength;
+    int c = memcmp(a, b, n);
+    if (c != 0) return c;
+    return aLength - bLength;
+}
+
+/*
+ * qsort comparison: group lines by query and then by subject, best bit
+ * score first.
+ */
+int compareBySubject(const void *p1, const void *p2)
+{
+    const HitLine *h1 = p1;
+    const HitLine *h2 = p2;
+
+    if (h1->query != h2->query) return h1->query - h2->query;
+    int c = compareFields(h1->subject, h1->subjectLength, h2->subject,
+      h2->subjectLength);
+    if (c != 0) return c;
+    if (h1->bitScore > h2->bitScore) return -1;
+    if (h1->bitScore < h2->bitScore) return 1;
+    return h1->order - h2->order;
+}
+
+/*
+ * qsort comparison: order the subjects of each query by their best bit
+ * score, keeping the lines for one subject together in their original order.
+ */
+int compareByRank(const void *p1, const void *p2)
+{
+    const HitLine *h1 = p1;
+    const HitLine *h2 = p2;
+
+    if (h1->query != h2->query) return h1->query - h2->query;
+    if (h1->bestBitScore > h2->bestBitScore) return -1;
+    if (h1->bestBitScore < h2->bestBitScore) return 1;
+    int c = compareFields(h1->subject, h1->subjectLength, h2->subject,
+      h2->subjectLength);
+    if (c != 0) return c;
+    return h1->order - h2->order;
+}
+
+/*
+ * Merge the tabular blast output from all the shards for one block of
+ * queries. For each query only the lines for the maxTargetSeqs subjects
+ * with the best bit scores are kept, just as if the whole database had
+ * been searched. The lines for a query are kept together, and the queries
+ * appear in the order they are first seen in the shard outputs.
+ *
+ * The shard text is modified (newlines are replaced by NULLs).
+ *
+ * Returns a malloc'ed string and sets *mergedLength to its length.
+ */
+char *mergeShardHits(char **shardText, int shardCount, int maxTargetSeqs,
+  size_t *mergedLength)
+{
+    HitLine *hits = NULL;
+    int hitCount = 0;
+    int hitAlloc = 0;
+
+    // query names, in the order first seen
+    char **queryNames = NULL;
+    int *queryLengths = NULL;
+    int queryCount = 0;
+    int queryAlloc = 0;
+
+    size_t totalLength = 0;
+
+    int k;
+    for (k = 0; k < shardCount; k++)
+    {
+        char *p = shardText[k];
+
+        // the query of the previous line, to avoid searching queryNames
+        // for every line
+        int lastQuery = -1;
+
+        totalLength += strlen(p);
+
+        while (*p != 0)
+        {
+            char *line = p;
+            char *newline = strchr(p, '\n');
+            if (newline != NULL)
+            {
+                *newline = 0;
+                p = newline + 1;
+            }
+            else
+            {
+                p += strlen(p);
+            }
+
+            // skip blank lines and comments
+            if (line[0] == 0 || line[0] == '#') continue;
+
+            // find the start of each of the twelve tab-separated fields
+            char *field[12];
+            int f = 0;
+            char *q = line;
+            field[f++] = q;
+            while (f < 12 && (q = strchr(q, '\t')) != NULL)
+            {
+                q += 1;
+                field[f++] = q;
+            }
+            if (f < 12)
+            {
+                fatal("mergeShardHits: -dbshards requires -outfmt 6 output");
+            }
+
+            int queryLength = field[1] - field[0] - 1;
+
+            if (lastQuery < 0 || compareFields(queryNames[lastQuery],
+              queryLengths[lastQuery], field[0], queryLength) != 0)
+            {
+                int i;
+                for (i = 0; i < queryCount; i++)
+                {
+                    if (compareFields(queryNames[i], queryLengths[i],
+                      field[0], queryLength) == 0) break;
+                }
+                if (i == queryCount)
+                {
+                    if (queryCount == queryAlloc)
+                    {
+                        queryAlloc = (queryAlloc == 0) ? 64 : queryAlloc * 2;
+                        queryNames = realloc(queryNames,
+                          sizeof(char *) * queryAlloc);
+                        queryLengths = realloc(queryLengths,
+                          sizeof(int) * queryAlloc);
+                        if (queryNames == NULL || queryLengths == NULL)
+                        {
+                            fatal("mergeShardHits: realloc failed");
+                        }
+                    }
+                    queryNames[queryCount] = field[0];
+                    queryLengths[queryCount] = queryLength;
+                    queryCount++;
+                }
+                lastQuery = i;
+            }
+
+            if (hitCount == hitAlloc)
+            {
+                hitAlloc = (hitAlloc == 0) ? 1024 : hitAlloc * 2;
+                hits = realloc(hits, sizeof(HitLine) * hitAlloc);
+                if (hits == NULL) fatal("mergeShardHits: realloc failed");
+            }
+            hits[hitCount].line = line;
+            hits[hitCount].subject = field[1];
+            hits[hitCount].subjectLength = field[2] - field[1] - 1;
+            hits[hitCount].query = lastQuery;
+            hits[hitCount].order = hitCount;
+            hits[hitCount].bitScore = strtod(field[11], NULL);
+            hitCount++;
+        }
+    }
+
+    // find the best bit score for each query and subject
+    if (hitCount > 0) qsort(hits, hitCount, sizeof(HitLine), compareBySubject);
+    int i = 0;
+    while (i < hitCount)
+    {
+        int j = i;
+        while (j < hitCount && hits[j].query == hits[i].query &&
+          compareFields(hits[j].subject, hits[j].subjectLength,
+          hits[i].subject, hits[i].subjectLength) == 0)
+        {
+            hits[j].bestBitScore = hits[i].bitScore;
+            j++;
+        }
+        i = j;
+    }
+
+    // now keep the lines for the best subjects of each query
+    if (hitCount > 0) qsort(hits, hitCount, sizeof(HitLine), compareByRank);
+
+    char *merged = malloc(totalLength + 1);
+    if (merged == NULL) fatal("mergeShardHits: malloc failed");
+    size_t length = 0;
+
+    int subjectsKept = 0;
+    for (i = 0; i < hitCount; i++)
+    {
+        if (i == 0 || hits[i].query != hits[i-1].query)
+        {
+            subjectsKept = 0;
+        }
+        if (i == 0 || hits[i].query != hits[i-1].query ||
+          compareFields(hits[i].subject, hits[i].subjectLength,
+          hits[i-1].subject, hits[i-1].subjectLength) != 0)
+        {
+            subjectsKept++;
+        }
+        if (subjectsKept <= maxTargetSeqs)
+        {
+            size_t n = strlen(hits[i].line);
+            memcpy(merged + length, hits[i].line, n);
+            length += n;
+            merged[length++] = '\n';
+        }
+    }
+    merged[length] = 0;
+
+    free(hits);
+    free(queryNames);
+    free(queryLengths);
+
+    *mergedLength = length;
+    return merged;
+}
+
+/*
+ * gzip a frame of output into a single gzip member.
+ *
+ * Returns a malloc'ed buffer and sets *compressedLength to its length.
+ */
+char *deflateText(char *text, size_t length, size_t *compressedLength)
+{
+    z_stream strm;
+
+    strm.zalloc = Z_NULL;
+    strm.zfree = Z_NULL;
+    strm.opaque = Z_NULL;
+
+    //windowBits of 15+16 asks zlib for a gzip header and trailer
+    if (deflateInit2(&strm, GZIP_LEVEL, Z_DEFLATED, 15 + 16, 8,
+      Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+        fatal("deflateText: deflateInit2 failed");
+    }
+
+    uLong bound = deflateBound(&strm, length);
+    char *zbuffer = malloc(bound);
+    if (zbuffer == NULL) fatal("deflateText: malloc failed");
+
+    strm.next_in = (Bytef *) text;
+    strm.avail_in = length;
+    strm.next_out = (Bytef *) zbuffer;
+    strm.avail_out = bound;
+
+    if (deflate(&strm, Z_FINISH) != Z_STREAM_END)
+    {
+        fatal("deflateText: deflate failed");
+    }
+
+    *compressedLength = bound - strm.avail_out;
+    deflateEnd(&strm);
+
+    return zbuffer;
+}
+
+/*
+ * A block whose output has arrived from every shard, waiting to be merged
+ * and written.
+ */
+typedef struct FrameTask
+{
+    char **shardText;
+    struct FrameTask *next;
+} FrameTask;
+
+/*
+ * The blocks waiting to be merged and written, and the output they are
+ * written to. The writer adds blocks as they complete, and its helper
+ * threads (frameWriter) merge and compress them, so that this work does not
+ * hold up the receiving of output from the workers.
+ */
+typedef struct
+{
+    FrameTask *head;
+    FrameTask *tail;
+    int count;
+    int done;                 // set when no more blocks will be added
+    pthread_mutex_t lock;     // protects the above
+    pthread_cond_t changed;   // signalled when the above change
+
+    FILE *fp;
+    FILE *indexFp;
+    long long frameOffset;    // offset where the next frame will start
+    pthread_mutex_t fileLock; // protects the above
+
+    int compress;
+    int shardCount;
+    int maxTargetSeqs;
+} FrameQueue;
+
+/*
+ * Add a block to the queue, waiting if the helper threads are too far
+ * behind (which holds up the workers rather than using unbounded memory).
+ */
+void addFrameTask(FrameQueue *queue, char **shardText)
+{
+    FrameTask *task = malloc(sizeof(FrameTask));
+    if (task == NULL) fatal("addFrameTask: malloc failed");
+    task->shardText = shardText;
+    task->next = NULL;
+
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count >= MAX_QUEUED_FRAMES)
+    {
+        pthread_cond_wait(&queue->changed, &queue->lock);
+    }
+    if (queue->tail == NULL) queue->head = task;
+    else queue->tail->next = task;
+    queue->tail = task;
+    queue->count += 1;
+    pthread_cond_broadcast(&queue->changed);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+/*
+ * A helper thread of the writer: merge the blocks in the queue, gzip them
+ * if compress is set, and write each as one frame, recording it in the
+ * frame index if there is one.
+ */
+void *frameWriter(void *args)
+{
+    FrameQueue *queue = (FrameQueue *) args;
+
+    while (1)
+    {
+        pthread_mutex_lock(&queue->lock);
+        while (queue->head == NULL && !queue->done)
+        {
+            pthread_cond_wait(&queue->changed, &queue->lock);
+        }
+        FrameTask *task = queue->head;
+        if (task == NULL)
+        {
+            pthread_mutex_unlock(&queue->lock);
+            return NULL;
+        }
+        queue->head = task->next;
+        if (queue->head == NULL) queue->tail = NULL;
+        queue->count -= 1;
+        pthread_cond_broadcast(&queue->changed);
+        pthread_mutex_unlock(&queue->lock);
+
+        size_t mergedLength;
+        char *merged = mergeShardHits(task->shardText, queue->shardCount,
+          queue->maxTargetSeqs, &mergedLength);
+
+        char *data = merged;
+        size_t n = mergedLength;
+        if (queue->compress) data = deflateText(merged, mergedLength, &n);
+
+        pthread_mutex_lock(&queue->fileLock);
+        if (fwrite(data, 1, n, queue->fp) != n)
+        {
+            fatal("frameWriter: fwrite failed");
+        }
+        if (queue->compress && queue->indexFp != NULL)
+        {
+            fprintf(queue->indexFp, "%lld %lld %lld\n", queue->frameOffset,
+              (long long) n, (long long) mergedLength);
+        }
+        queue->frameOffset += n;
+        pthread_mutex_unlock(&queue->fileLock);
+
+        if (data != merged) free(data);
+        free(merged);
+
+        int k;
+        for (k = 0; k < queue->shardCount; k++) free(task->shardText[k]);
+        free(task->shardText);
+        free(task);
+    }
+}
+
 //the writer process receives messages from the worker processes, and 
 //writes those messages to a file.  The writer process is used so that
 //all of the output is consolidated into one file. 
 //
 //The writer process will run until a complete message is sent to it from the 
 //scheduler process
-void writer(char* filename)
+//
+//agent Oct 2026: when compress is set the messages are pieces of gzip members
+//and are written verbatim. The end message then carries the uncompressed
+//length of the member, and if indexFilename is not NULL a line giving the
+//offset, compressed length and uncompressed length of the member is
+//written to that file.
+//
+//agent Oct 2026: when shardCount is greater than one, the output for a block
+//of queries is held until it has arrived from every shard, and then the
+//merged hits for the block are written as a single frame. The merging and
+//compressing is done by WRITER_THREADS helper threads, since otherwise the
+//writer would do all the compressing that the workers do without shards.
+void writer(char* filename, char* indexFilename, int compress,
+  int shardCount, int maxTargetSeqs)
 {
 #ifdef DEBUG
     fprintf(stderr, "writer started\n");
@@ -421,6 +944,53 @@ void writer(char* filename)
         fprintf(stderr, "%s, %s\n", filename, strerror(errno));
         exit(EXIT_FAILURE);
     }
+
+    //open frame index file, if one was requested
+    FILE *indexFp = NULL;
+
+    if (indexFilename != NULL)
+    {
+        indexFp = fopen(indexFilename, "w");
+        if (indexFp == NULL) fatal("writer: fopen of frame index failed");
+    }
+
+    //offset in the output file where the next frame will start
+    long long frameOffset = 0;
+
+    //with shards, the completed blocks are merged and written by threads
+    FrameQueue queue;
+    pthread_t frameWriters[WRITER_THREADS];
+    int t;
+
+    if (shardCount > 1)
+    {
+        queue.head = NULL;
+        queue.tail = NULL;
+        queue.count = 0;
+        queue.done = 0;
+        pthread_mutex_init(&queue.lock, NULL);
+        pthread_cond_init(&queue.changed, NULL);
+        queue.fp = fp;
+        queue.indexFp = indexFp;
+        queue.frameOffset = 0;
+        pthread_mutex_init(&queue.fileLock, NULL);
+        queue.compress = compress;
+        queue.shardCount = shardCount;
+        queue.maxTargetSeqs = maxTargetSeqs;
+
+        for (t = 0; t < WRITER_THREADS; t++)
+        {
+            if (pthread_create(&frameWriters[t], NULL, frameWriter,
+              &queue) != 0)
+            {
+                fatal("writer: pthread_create failed");
+            }
+        }
+    }
+
+    //blocks still waiting for output from some of the shards
+    PendingBlock **pending = NULL;
+    int pendingAlloc = 0;
   
     //received messages are placed in here
     char *buffer; 
@@ -447,8 +1017,34 @@ void writer(char* filename)
         //if from the scheduler, then we need to exit
         if(sender == SCHEDULER_PROCESS)
         {
+            //let the helper threads finish the blocks still queued
+            if (shardCount > 1)
+            {
+                pthread_mutex_lock(&queue.lock);
+                queue.done = 1;
+                pthread_cond_broadcast(&queue.changed);
+                pthread_mutex_unlock(&queue.lock);
+                for (t = 0; t < WRITER_THREADS; t++)
+                {
+                    pthread_join(frameWriters[t], NULL);
+                }
+            }
+
             fclose(fp);
 
+            if (indexFp != NULL) fclose(indexFp);
+
+            //sanity check: every block should have been written
+            int b;
+            for (b = 0; b < pendingAlloc; b++)
+            {
+                if (pending[b] != NULL)
+                {
+                    fatal("writer: block missing output from some shards");
+                }
+            }
+            free(pending);
+
             free(buffer);
 #ifdef DEBUG
             fprintf(stderr, "writer exiting\n");
@@ -460,6 +1056,22 @@ void writer(char* filename)
         //end tag is sent
         else
         {
+            long long frameLength = 0;
+
+            //with shards, the text is collected so it can be merged
+            char *text = NULL;
+            size_t textLength = 0;
+            size_t textAlloc = 0;
+
+            //the begin message gives the block and shard numbers
+            int block = 0;
+            int shard = 0;
+            if (shardCount > 1 &&
+              sscanf(buffer, "%d %d", &block, &shard) != 2)
+            {
+                fatal("writer: bad begin message");
+            }
+
             while(tag != END_TAG)
             { 
                 MPI_Recv(buffer, BUFFER_SIZE, MPI_CHAR, sender, MPI_ANY_TAG,
@@ -472,7 +1084,87 @@ void writer(char* filename)
   
                 //if it is a valid message, print it to file
                 if(tag == MESSAGE_TAG) 
-                    fprintf(fp, "%s", buffer);
+                {
+                    if (shardCount > 1)
+                    {
+                        appendText(&text, &textLength, &textAlloc, buffer,
+                          strlen(buffer));
+                    }
+                    else if (compress)
+                    {
+                        //compressed data is binary, so use the actual count
+                        int countReceived;
+                        MPI_Get_count(&status, MPI_CHAR, &countReceived);
+                        if (fwrite(buffer, 1, countReceived, fp) !=
+                          (size_t) countReceived)
+                        {
+                            fatal("writer: fwrite failed");
+                        }
+                        frameLength += countReceived;
+                    }
+                    else
+                        fprintf(fp, "%s", buffer);
+                }
+            }
+
+            if (shardCount > 1)
+            {
+                //a shard may have produced no hits at all
+                if (text == NULL)
+                {
+                    appendText(&text, &textLength, &textAlloc, "", 0);
+                }
+
+                //make room for this block
+                if (block >= pendingAlloc)
+                {
+                    int newAlloc = (pendingAlloc == 0) ? 64 : pendingAlloc;
+                    while (block >= newAlloc) newAlloc *= 2;
+                    pending = realloc(pending,
+                      sizeof(PendingBlock *) * newAlloc);
+                    if (pending == NULL) fatal("writer: realloc failed");
+                    memset(pending + pendingAlloc, 0,
+                      sizeof(PendingBlock *) * (newAlloc - pendingAlloc));
+                    pendingAlloc = newAlloc;
+                }
+                if (pending[block] == NULL)
+                {
+                    pending[block] = malloc(sizeof(PendingBlock));
+                    if (pending[block] == NULL) fatal("writer: malloc failed");
+                    pending[block]->shardText =
+                      calloc(shardCount, sizeof(char *));
+                    if (pending[block]->shardText == NULL)
+                    {
+                        fatal("writer: calloc failed");
+                    }
+                    pending[block]->shardsReceived = 0;
+                }
+                if (shard < 0 || shard >= shardCount ||
+                  pending[block]->shardText[shard] != NULL)
+                {
+                    fatal("writer: unexpected shard output");
+                }
+                pending[block]->shardText[shard] = text;
+                pending[block]->shardsReceived += 1;
+
+                //once every shard has reported, hand the block to the
+                //helper threads to be merged and written
+                if (pending[block]->shardsReceived == shardCount)
+                {
+                    addFrameTask(&queue, pending[block]->shardText);
+                    free(pending[block]);
+                    pending[block] = NULL;
+                }
+            }
+            //the end message carries the uncompressed length of the frame
+            else if (compress)
+            {
+                if (indexFp != NULL)
+                {
+                    fprintf(indexFp, "%lld %lld %s\n", frameOffset,
+                      frameLength, buffer);
+                }
+                frameOffset += frameLength;
             }
         }
     }  
@@ -538,54 +1230,1105 @@ void *workerHelper(void *args)
     return NULL;
 }
 
-//the worker function 
-void worker(int rank, char** blastArgs)
+/*
+ * agent Oct 2026: read the output of a blast invocation from a pipe and
+ * send it to the writer as a single gzip member. The message that ends
+ * the member carries the number of uncompressed bytes, so the writer can
+ * record it in the frame index.
+ *
+ * fd - read end of the pipe from blast
+ * buffer - BUFFER_SIZE bytes for the data read from the pipe
+ */
+void sendCompressedOutput(int fd, char *buffer)
 {
-#ifdef DEBUG
-    fprintf(stderr, "worker %d started\n", rank);
-#endif
-    MPI_Status status;  
-    
-    //pipes that will be used
-    int toBlastPipe[2];
-    int fromBlastPipe[2];
-  
-    int blocksSearched = 0;
+    z_stream strm;
+
+    //compressed data is placed here before being sent to the writer
+    char *zbuffer;
+
+    //count of bytes read from blast
+    long long totalRead = 0;
 
     int errorCheck;
- 
-    int tag = BEGIN_TAG;
- 
-    //buffer that received messages will be placed into
-    char *buffer;
-  
-    buffer = malloc(BUFFER_SIZE);
-    if (buffer == NULL) fatal("worker: malloc failed");
-  
-    //send ready message to scheduler
-    if((errorCheck = MPI_Send("", 1, MPI_CHAR, SCHEDULER_PROCESS, 0,
-      MPI_COMM_WORLD)) != MPI_SUCCESS)
+
+    int flush = Z_NO_FLUSH;
+
+    zbuffer = malloc(BUFFER_SIZE);
+    if (zbuffer == NULL) fatal("sendCompressedOutput: malloc failed");
+
+    strm.zalloc = Z_NULL;
+    strm.zfree = Z_NULL;
+    strm.opaque = Z_NULL;
+
+    //windowBits of 15+16 asks zlib for a gzip header and trailer
+    if (deflateInit2(&strm, GZIP_LEVEL, Z_DEFLATED, 15 + 16, 8,
+      Z_DEFAULT_STRATEGY) != Z_OK)
     {
-        fprintf(stderr, "MPI error sending ready message to scheduler!\n");
+        fatal("sendCompressedOutput: deflateInit2 failed");
     }
 
-    //receive start message
-    if((errorCheck = MPI_Recv(buffer, BUFFER_SIZE, MPI_CHAR, SCHEDULER_PROCESS,
-      MPI_ANY_TAG, MPI_COMM_WORLD, &status)) != MPI_SUCCESS)
+    while (flush != Z_FINISH)
     {
-        fprintf(stderr, "MPI error receiving start message from scheduler!\n");
-    }
+        int bytesRead = read(fd, buffer, BUFFER_SIZE);
 
-#ifdef DEBUG
-    fprintf(stderr, "worker %d initialized\n", rank);
-#endif
-    tag = status.MPI_TAG;
+        if (bytesRead < 0)
+        {
+            fprintf(stderr, "Read error on blast pipe, errno is %s\n",
+              strerror(errno));
+            bytesRead = 0;
+        }
+
+        //no more output from blast, so close out the gzip member
+        if (bytesRead == 0) flush = Z_FINISH;
+
+        totalRead += bytesRead;
+
+        strm.next_in = (Bytef *) buffer;
+        strm.avail_in = bytesRead;
+
+        //send compressed data to the writer each time zbuffer fills up
+        do
+        {
+            strm.next_out = (Bytef *) zbuffer;
+            strm.avail_out = BUFFER_SIZE;
+
+            if (deflate(&strm, flush) == Z_STREAM_ERROR)
+            {
+                fatal("sendCompressedOutput: deflate failed");
+            }
+
+            int n = BUFFER_SIZE - strm.avail_out;
+
+            if (n > 0)
+            {
+#ifdef DEBUG
+    fprintf(stderr, "sending %d compressed bytes to writer\n", n);
+#endif
+                if((errorCheck = MPI_Send(zbuffer, n, MPI_CHAR,
+                  WRITER_PROCESS, MESSAGE_TAG, MPI_COMM_WORLD)) !=
+                  MPI_SUCCESS)
+                {
+                    fprintf(stderr, "MPI Error sending data to writer!\n");
+                }
+            }
+        } while (strm.avail_out == 0);
+    }
+
+    deflateEnd(&strm);
+
+    //send end tag, with the uncompressed length, to close connection
+    snprintf(zbuffer, BUFFER_SIZE, "%lld", totalRead);
+    if((errorCheck = MPI_Send(zbuffer, strlen(zbuffer) + 1, MPI_CHAR,
+      WRITER_PROCESS, END_TAG, MPI_COMM_WORLD)) != MPI_SUCCESS)
+    {
+        fprintf(stderr, "Error sending end tag to writer!\n"); 
+    }
+
+    free(zbuffer);
+}
+
+/*
+ * agent Oct 2026: the support below is used by the workers when mpiBlast is
+ * given -dbshards or -candidates. Blast then searches only part of the
+ * database, and even with -dbsize giving the length of the whole database
+ * its e-values are not those of the whole database: blast subtracts the
+ * length adjustment of the query from the database length once for each
+ * sequence in the part it searches, rather than for each sequence in the
+ * whole database. So blast is given a relaxed -evalue and asked for the
+ * query length and raw score of each hit, and the worker recomputes each
+ * e-value with the length, sequence count and length adjustment of the
+ * whole database, as blast does for an unsharded search, and keeps only
+ * the hits within the real -evalue.
+ */
+
+/*
+ * Karlin-Altschul parameters for a scoring system.
+ */
+typedef struct
+{
+    double lambda;
+    double k;
+    double alpha;
+    double beta;
+} KarlinParameters;
+
+// BLOSUM62 with gap costs 11/1 (the blastp default)
+static const KarlinParameters proteinParameters = { 0.267, 0.041, 1.9, -30 };
+
+// reward 1, penalty -2, linear gap costs (the megablast default)
+static const KarlinParameters nucleotideParameters = { 1.28, 0.46, 1.5, -2 };
+
+/*
+ * What a worker needs to recompute the e-values of the hits.
+ */
+typedef struct
+{
+    const KarlinParameters *p;
+    long long dbLength;   // length of the whole database
+    int dbCount;          // number of sequences in the whole database
+    double threshold;     // the -evalue given to mpiBlast
+} Rescoring;
+
+/*
+ * Compute the length adjustment for a query, which is subtracted from the
+ * query length and from the length of each database sequence to get the
+ * effective search space. This follows BLAST_ComputeLengthAdjustment in
+ * the NCBI toolkit (it is the same as in selfScore.c).
+ */
+int lengthAdjustment(const KarlinParameters *p, int queryLength,
+  long long dbLength, int dbCount)
+{
+    const int maxIterations = 20;
+    double m = queryLength;
+    double n = dbLength;
+    double N = dbCount;
+    double logK = log(p->k);
+    double alphaDLambda = p->alpha / p->lambda;
+    double ellMin = 0;
+    double ellMax;
+    double ellNext = 0;
+    double ell;
+    double ss;
+    int converged = 0;
+    int i;
+
+    double a = N;
+    double mb = m * N + n;
+    double c = n * m - (m > 1.0 / p->k ? m : 1.0 / p->k) / p->k;
+    if (c < 0) return 0;
+    ellMax = 2 * c / (mb + sqrt(mb * mb - 4 * a * c));
+
+    for (i = 1; i <= maxIterations; i++)
+    {
+        ell = ellNext;
+        ss = (m - ell) * (n - N * ell);
+        double ellBar = alphaDLambda * (logK + log(ss)) + p->beta;
+        if (ellBar >= ell)
+        {
+            ellMin = ell;
+            if (ellBar - ellMin <= 1.0)
+            {
+                converged = 1;
+                break;
+            }
+            if (ellMin == ellMax) break;
+        }
+        else
+        {
+            ellMax = ell;
+        }
+        if (ellMin <= ellBar && ellBar <= ellMax)
+        {
+            ellNext = ellBar;
+        }
+        else
+        {
+            ellNext = (i == 1) ? ellMax : (ellMin + ellMax) / 2;
+        }
+    }
+
+    int adjustment = (int) ellMin;
+    if (converged)
+    {
+        ell = ceil(ellMin);
+        if (ell <= ellMax)
+        {
+            ss = (m - ell) * (n - N * ell);
+            if (alphaDLambda * (logK + log(ss)) + p->beta >= ell)
+            {
+                adjustment = (int) ell;
+            }
+        }
+    }
+    return adjustment;
+}
+
+/*
+ * Format an e-value the way blast's tabular output does.
+ */
+void formatEvalue(double evalue, char *buffer, int size)
+{
+    if (evalue < 1.0e-180)
+    {
+        snprintf(buffer, size, "0.0");
+    }
+    else if (evalue < 1.0e-99)
+    {
+        snprintf(buffer, size, "%2.0le", evalue);
+    }
+    else if (evalue < 0.0009)
+    {
+        snprintf(buffer, size, "%3.0le", evalue);
+    }
+    else if (evalue < 0.1)
+    {
+        snprintf(buffer, size, "%4.3lf", evalue);
+    }
+    else if (evalue < 1.0)
+    {
+        snprintf(buffer, size, "%3.2lf", evalue);
+    }
+    else if (evalue < 10.0)
+    {
+        snprintf(buffer, size, "%2.1lf", evalue);
+    }
+    else
+    {
+        snprintf(buffer, size, "%.0lf", evalue);
+    }
+}
+
+/*
+ * Recompute the e-values of the blast output for one block of queries.
+ * The text is tabular output with the fields "std qlen score", and the
+ * result is "std" output (i.e. -outfmt 6) holding only the lines whose
+ * recomputed e-value is within the threshold.
+ *
+ * The text is modified (newlines are replaced by NULLs).
+ *
+ * Returns a malloc'ed string and sets *newLength to its length.
+ */
+char *rescoreHits(char *text, Rescoring *rescoring, size_t *newLength)
+{
+    const KarlinParameters *p = rescoring->p;
+
+    char *result = malloc(strlen(text) + 1);
+    if (result == NULL) fatal("rescoreHits: malloc failed");
+    size_t length = 0;
+
+    // effective database length for the query of the previous line, which
+    // is usually the query of this line too
+    int lastQueryLength = -1;
+    double m = 0;
+    double n = 0;
+
+    char *next = text;
+    while (*next != 0)
+    {
+        char *line = next;
+        char *newline = strchr(next, '\n');
+        if (newline != NULL)
+        {
+            *newline = 0;
+            next = newline + 1;
+        }
+        else
+        {
+            next += strlen(next);
+        }
+
+        // skip blank lines and comments
+        if (line[0] == 0 || line[0] == '#') continue;
+
+        // find the start of each of the fourteen tab-separated fields
+        char *field[14];
+        int f = 0;
+        char *q = line;
+        field[f++] = q;
+        while (f < 14 && (q = strchr(q, '\t')) != NULL)
+        {
+            q += 1;
+            field[f++] = q;
+        }
+        if (f < 14) fatal("rescoreHits: unexpected blast output");
+
+        int queryLength = atoi(field[12]);
+        double score = strtod(field[13], NULL);
+
+        if (queryLength != lastQueryLength)
+        {
+            int adjustment = lengthAdjustment(p, queryLength,
+              rescoring->dbLength, rescoring->dbCount);
+            m = queryLength - adjustment;
+            n = rescoring->dbLength - (double) rescoring->dbCount * adjustment;
+            if (m < 1) m = 1;
+            if (n < 1) n = 1;
+            lastQueryLength = queryLength;
+
+            // blast's e-values for part of the database are at most
+            // dbLength / n times the real ones, so it must not have
+            // dropped a hit the whole database would have kept
+            if (rescoring->dbLength / n > EVALUE_SLACK)
+            {
+                fatal("rescoreHits: database too small for -dbshards or "
+                  "-candidates");
+            }
+        }
+
+        double evalue = p->k * m * n * exp(-p->lambda * score);
+        if (evalue > rescoring->threshold) continue;
+
+        // copy the fields before the e-value, then the new e-value, and
+        // then the bit score (which does not depend on the database)
+        char evalueText[32];
+        formatEvalue(evalue, evalueText, sizeof(evalueText));
+        size_t k = field[10] - field[0];
+        memcpy(result + length, line, k);
+        length += k;
+        k = strlen(evalueText);
+        memcpy(result + length, evalueText, k);
+        length += k;
+        result[length++] = '\t';
+        k = field[12] - field[11] - 1;
+        memcpy(result + length, field[11], k);
+        length += k;
+        result[length++] = '\n';
+    }
+    result[length] = 0;
+
+    *newLength = length;
+    return result;
+}
+
+/*
+ * Send text to the writer, as a gzip member if compress is set, followed
+ * by the end message.
+ *
+ * buffer - BUFFER_SIZE bytes for the messages
+ */
+void sendText(char *text, size_t length, int compress, char *buffer)
+{
+    int errorCheck;
+
+    //when compressing, the end message carries the uncompressed length
+    char *data = text;
+    size_t dataLength = length;
+    if (compress)
+    {
+        data = deflateText(text, length, &dataLength);
+    }
+
+    size_t sent = 0;
+    while (sent < dataLength)
+    {
+        size_t n = dataLength - sent;
+        if (compress)
+        {
+            if (n > BUFFER_SIZE) n = BUFFER_SIZE;
+            memcpy(buffer, data + sent, n);
+        }
+        else
+        {
+            //uncompressed messages are NULL terminated, and sent whole
+            if (n > BUFFER_SIZE - 1) n = BUFFER_SIZE - 1;
+            memcpy(buffer, data + sent, n);
+            buffer[n] = 0;
+        }
+        if((errorCheck = MPI_Send(buffer, compress ? (int) n : BUFFER_SIZE,
+          MPI_CHAR, WRITER_PROCESS, MESSAGE_TAG, MPI_COMM_WORLD)) !=
+          MPI_SUCCESS)
+        {
+            fprintf(stderr, "MPI Error sending data to writer!\n");
+        }
+        sent += n;
+    }
+
+    if (compress)
+    {
+        snprintf(buffer, BUFFER_SIZE, "%lld", (long long) length);
+        free(data);
+    }
+    else
+    {
+        buffer[0] = 0;
+    }
+    if((errorCheck = MPI_Send(buffer, strlen(buffer) + 1, MPI_CHAR,
+      WRITER_PROCESS, END_TAG, MPI_COMM_WORLD)) != MPI_SUCCESS)
+    {
+        fprintf(stderr, "Error sending end tag to writer!\n");
+    }
+}
+
+/*
+ * agent Oct 2026: the support below is used by the workers when mpiBlast is
+ * given -candidates. The candidates file (written by kmerPrefilter) gives,
+ * for each query, the database sequences that are worth searching. For each
+ * block of queries the worker builds a small database containing just the
+ * candidates of those queries and has blast search that instead.
+ */
+
+/*
+ * A name and its associated text: either a query and its list of
+ * candidates, or a database sequence and its FASTA record.
+ */
+typedef struct
+{
+    char *name;
+    char *text;
+} NamedText;
+
+/*
+ * A sorted table of NamedText, searched with bsearch.
+ */
+typedef struct
+{
+    NamedText *entries;
+    int count;
+} NamedTextTable;
+
+int compareNamedText(const void *p1, const void *p2)
+{
+    return strcmp(((const NamedText *) p1)->name,
+      ((const NamedText *) p2)->name);
+}
+
+/*
+ * Find the entry for a name, or return NULL.
+ */
+NamedText *lookupName(NamedTextTable *table, char *name)
+{
+    NamedText key;
+    key.name = name;
+    return bsearch(&key, table->entries, table->count, sizeof(NamedText),
+      compareNamedText);
+}
+
+/*
+ * Add an entry to a table that is being built (it is sorted later).
+ */
+void addNamedText(NamedTextTable *table, int *allocCount, char *name,
+  char *text)
+{
+    if (table->count == *allocCount)
+    {
+        *allocCount = (*allocCount == 0) ? 1024 : *allocCount * 2;
+        table->entries = realloc(table->entries,
+          sizeof(NamedText) * *allocCount);
+        if (table->entries == NULL) fatal("addNamedText: realloc failed");
+    }
+    table->entries[table->count].name = name;
+    table->entries[table->count].text = text;
+    table->count += 1;
+}
+
+/*
+ * Read the candidates file. Each line is a query name followed by the
+ * names of its candidates, separated by spaces.
+ */
+void loadCandidates(char *filename, NamedTextTable *table)
+{
+    FILE *fp = fopen(filename, "r");
+    if (fp == NULL) fatal("loadCandidates: fopen failed");
+
+    int allocCount = 0;
+    table->entries = NULL;
+    table->count = 0;
+
+    char *line = NULL;
+    size_t lineAlloc = 0;
+    while (getline(&line, &lineAlloc, fp) != -1)
+    {
+        line[strcspn(line, "\r\n")] = 0;
+        int len = strcspn(line, " ");
+        if (len == 0) continue;
+        char *name = strndup(line, len);
+        char *text = strdup(line + len);
+        if (name == NULL || text == NULL) fatal("loadCandidates: strdup failed");
+        addNamedText(table, &allocCount, name, text);
+    }
+    free(line);
+    fclose(fp);
+
+    qsort(table->entries, table->count, sizeof(NamedText), compareNamedText);
+}
+
+/*
+ * Read the FASTA records of the database. The name of a record is the
+ * text between the > and the first white space.
+ */
+void loadDbRecords(char *filename, NamedTextTable *table)
+{
+    FILE *fp = fopen(filename, "r");
+    if (fp == NULL) fatal("loadDbRecords: fopen of database FASTA failed");
+
+    int allocCount = 0;
+    table->entries = NULL;
+    table->count = 0;
+
+    char *record = NULL;
+    size_t recordLength = 0;
+    size_t recordAlloc = 0;
+
+    char *line = NULL;
+    size_t lineAlloc = 0;
+    ssize_t n;
+    while ((n = getline(&line, &lineAlloc, fp)) != -1)
+    {
+        if (line[0] == '>')
+        {
+            char *name = strndup(line + 1, strcspn(line + 1, " \t\r\n"));
+            if (name == NULL) fatal("loadDbRecords: strndup failed");
+            record = NULL;
+            recordLength = 0;
+            recordAlloc = 0;
+            appendText(&record, &recordLength, &recordAlloc, line, n);
+            addNamedText(table, &allocCount, name, record);
+        }
+        else if (table->count > 0)
+        {
+            appendText(&record, &recordLength, &recordAlloc, line, n);
+            table->entries[table->count - 1].text = record;
+        }
+    }
+    free(line);
+    fclose(fp);
+
+    qsort(table->entries, table->count, sizeof(NamedText), compareNamedText);
+}
+
+/*
+ * Receive a block of queries from the scheduler (everything up to the end
+ * tag) and return it as a string.
+ */
+char *receiveBlock(void)
+{
+    char *block = NULL;
+    size_t blockLength = 0;
+    size_t blockAlloc = 0;
+
+    char buffer[BUFFER_SIZE];
+
+    MPI_Status status;
+
+    int tag = BEGIN_TAG;
+
+    appendText(&block, &blockLength, &blockAlloc, "", 0);
+
+    while(tag != END_TAG)
+    {
+        MPI_Recv(buffer, BUFFER_SIZE, MPI_CHAR, SCHEDULER_PROCESS,
+          MPI_ANY_TAG, MPI_COMM_WORLD, &status);
+
+        tag = status.MPI_TAG;
+
+        if(tag != END_TAG)
+        {
+            int countReceived;
+            MPI_Get_count(&status, MPI_CHAR, &countReceived);
+            appendText(&block, &blockLength, &blockAlloc, buffer,
+              countReceived);
+        }
+    }
+
+    return block;
+}
+
+/*
+ * Write to dbFile the FASTA records of the candidates of the queries in
+ * the block, and format them as a blast database.
+ *
+ * Returns the number of sequences in the database. If this is zero, then
+ * no database was built, and there is nothing for blast to do.
+ */
+int makeRestrictedDb(char *block, NamedTextTable *candidates,
+  NamedTextTable *dbRecords, char *dbType, char *dbFile)
+{
+    // marks the database sequences already written
+    char *used = calloc(dbRecords->count + 1, 1);
+    if (used == NULL) fatal("makeRestrictedDb: calloc failed");
+
+    FILE *fp = fopen(dbFile, "w");
+    if (fp == NULL) fatal("makeRestrictedDb: fopen failed");
+
+    int sequenceCount = 0;
+
+    char *p = block;
+    while (*p != 0)
+    {
+        char *end = strchr(p, '\n');
+        if (end == NULL) end = p + strlen(p);
+
+        if (*p == '>')
+        {
+            // look up the query
+            int len = strcspn(p + 1, " \t\r\n");
+            char *name = strndup(p + 1, len);
+            if (name == NULL) fatal("makeRestrictedDb: strndup failed");
+            NamedText *query = lookupName(candidates, name);
+            free(name);
+
+            // write out the records of its candidates
+            char *c = (query != NULL) ? query->text : "";
+            while (*c != 0)
+            {
+                c += strspn(c, " ");
+                len = strcspn(c, " ");
+                if (len == 0) break;
+                name = strndup(c, len);
+                if (name == NULL) fatal("makeRestrictedDb: strndup failed");
+                NamedText *record = lookupName(dbRecords, name);
+                if (record == NULL)
+                {
+                    fprintf(stderr, "candidate %s is not in the database\n",
+                      name);
+                    exit(EXIT_FAILURE);
+                }
+                free(name);
+                int r = record - dbRecords->entries;
+                if (!used[r])
+                {
+                    used[r] = 1;
+                    fputs(record->text, fp);
+                    sequenceCount += 1;
+                }
+                c += len;
+            }
+        }
+
+        p = (*end == 0) ? end : end + 1;
+    }
+
+    if (fclose(fp) != 0) fatal("makeRestrictedDb: write failed");
+    free(used);
+
+    if (sequenceCount > 0)
+    {
+        char *command = malloc(2 * strlen(dbFile) + 100);
+        if (command == NULL) fatal("makeRestrictedDb: malloc failed");
+        sprintf(command, "makeblastdb -dbtype %s -in %s -out %s >/dev/null",
+          dbType, dbFile, dbFile);
+        if (system(command) != 0)
+        {
+            fatal("makeRestrictedDb: makeblastdb failed");
+        }
+        free(command);
+    }
+
+    return sequenceCount;
+}
+
+/*
+ * The arguments for the thread that feeds a block that has already been
+ * received to blast.
+ */
+typedef struct
+{
+    int pipe;
+    char *block;
+} BlockWriterArgs;
+
+void *blockWriter(void *args)
+{
+    BlockWriterArgs *a = args;
+
+    size_t length = strlen(a->block);
+    size_t written = 0;
+
+    while (written < length)
+    {
+        ssize_t n = write(a->pipe, a->block + written, length - written);
+        if (n == -1)
+        {
+            fprintf(stderr, "Write error in blockWriter!\n");
+            break;
+        }
+        written += n;
+    }
+
+    close(a->pipe);
+
+    return NULL;
+}
+
+/*
+ * agent Oct 2026: the support below is used by the workers when mpiBlast is
+ * given -dbcache. The formatted database is expected to be in a directory
+ * of its own whose name is a hash of the database's contents (this is how
+ * doPairwiseBlasts.pl formats its databases), so that directory name can
+ * be used as the key for a copy of the database in node-local storage,
+ * such as /dev/shm. The copies are reused by later runs on the same node.
+ *
+ * The cache directory holds a subdirectory for each database copy, a
+ * <key>.lock file for each copy and a .lock file for the cache. A worker
+ * holds a shared lock on <key>.lock while it uses the copy, and a copy is
+ * only evicted when an exclusive lock on its <key>.lock can be had. Copies
+ * are only made and evicted while holding the lock on the cache's .lock,
+ * and the least recently used copies (by modification time, which is
+ * updated each time a copy is used) are evicted first.
+ */
+
+/*
+ * A database copy in the cache.
+ */
+typedef struct
+{
+    char name[NAME_MAX + 1];
+    time_t used;
+    long long size;
+} CacheEntry;
+
+int compareByUse(const void *p1, const void *p2)
+{
+    const CacheEntry *e1 = p1;
+    const CacheEntry *e2 = p2;
+    if (e1->used < e2->used) return -1;
+    if (e1->used > e2->used) return 1;
+    return 0;
+}
+
+/*
+ * Return the total size of the files in a directory, or -1 if it cannot
+ * be read. (A formatted database does not have subdirectories.)
+ */
+long long directorySize(char *path)
+{
+    DIR *dir = opendir(path);
+    if (dir == NULL) return -1;
+
+    long long total = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        char file[PATH_MAX];
+        struct stat st;
+        snprintf(file, sizeof(file), "%s/%s", path, entry->d_name);
+        if (stat(file, &st) == 0 && S_ISREG(st.st_mode))
+        {
+            total += st.st_size;
+        }
+    }
+    closedir(dir);
+
+    return total;
+}
+
+/*
+ * Remove a directory and everything in it.
+ */
+void removeDirectory(char *path)
+{
+    char *command = malloc(strlen(path) + 16);
+    if (command == NULL) fatal("removeDirectory: malloc failed");
+    sprintf(command, "rm -rf %s", path);
+    system(command);
+    free(command);
+}
+
+/*
+ * Evict the least recently used copies that are not in use until there is
+ * room in the cache for needed more bytes, or until nothing more can be
+ * evicted. Also removes copies left unfinished by a worker that died.
+ * The caller must hold the lock on the cache.
+ *
+ * Returns the size of the copies left in the cache, which is more than
+ * limit - needed when copies in use could not be evicted.
+ */
+long long evictCacheEntries(char *cacheDir, long long needed, long long limit)
+{
+    DIR *dir = opendir(cacheDir);
+    if (dir == NULL) return 0;
+
+    int allocCount = 16;
+    int count = 0;
+    CacheEntry *entries = malloc(sizeof(CacheEntry) * allocCount);
+    if (entries == NULL) fatal("evictCacheEntries: malloc failed");
+
+    long long total = 0;
+    struct dirent *d;
+    while ((d = readdir(dir)) != NULL)
+    {
+        char path[PATH_MAX];
+        struct stat st;
+        if (d->d_name[0] == '.') continue;
+        snprintf(path, sizeof(path), "%s/%s", cacheDir, d->d_name);
+        if (stat(path, &st) != 0 || !S_ISDIR(st.st_mode)) continue;
+
+        //unfinished copy
+        if (strstr(d->d_name, ".tmp") != NULL)
+        {
+            removeDirectory(path);
+            continue;
+        }
+
+        if (count == allocCount)
+        {
+            allocCount *= 2;
+            entries = realloc(entries, sizeof(CacheEntry) * allocCount);
+            if (entries == NULL) fatal("evictCacheEntries: realloc failed");
+        }
+        strcpy(entries[count].name, d->d_name);
+        entries[count].used = st.st_mtime;
+        entries[count].size = directorySize(path);
+        total += entries[count].size;
+        count += 1;
+    }
+    closedir(dir);
+
+    qsort(entries, count, sizeof(CacheEntry), compareByUse);
+
+    int i;
+    for (i = 0; i < count && total + needed > limit; i++)
+    {
+        char path[PATH_MAX];
+        char lockName[PATH_MAX + 8];
+        snprintf(path, sizeof(path), "%s/%s", cacheDir, entries[i].name);
+        snprintf(lockName, sizeof(lockName), "%s.lock", path);
+
+        int fd = open(lockName, O_RDWR | O_CREAT, 0666);
+        if (fd < 0) continue;
+        if (flock(fd, LOCK_EX | LOCK_NB) == 0)
+        {
+            removeDirectory(path);
+            unlink(lockName);
+            total -= entries[i].size;
+        }
+        close(fd);
+    }
+
+    free(entries);
+
+    return total;
+}
+
+/*
+ * Make sure there is a copy of the database in the cache, and return the
+ * name of the database in the copy, with a shared lock held on the copy
+ * (*entryLockFd is the file descriptor to close to release the lock). If
+ * the database is larger than the room that can be made in the cache, or
+ * cannot be copied, the database itself is returned and *entryLockFd is -1.
+ */
+char *stageDatabase(char *db, char *cacheDir, long long limit,
+  int *entryLockFd)
+{
+    *entryLockFd = -1;
+
+    //the key is the name of the directory containing the database
+    char *slash = strrchr(db, '/');
+    if (slash == NULL) return db;
+    char *source = strndup(db, slash - db);
+    if (source == NULL) fatal("stageDatabase: strndup failed");
+    char *key = strrchr(source, '/');
+    key = (key == NULL) ? source : key + 1;
+
+    char cacheLock[PATH_MAX];
+    char entry[PATH_MAX];
+    char entryLock[PATH_MAX + 8];
+    snprintf(cacheLock, sizeof(cacheLock), "%s/.lock", cacheDir);
+    snprintf(entry, sizeof(entry), "%s/%s", cacheDir, key);
+    snprintf(entryLock, sizeof(entryLock), "%s.lock", entry);
+
+    mkdir(cacheDir, 0777);
+    int cacheFd = open(cacheLock, O_RDWR | O_CREAT, 0666);
+    if (cacheFd < 0 || flock(cacheFd, LOCK_EX) != 0)
+    {
+        fprintf(stderr, "cannot lock database cache %s, using %s\n",
+          cacheDir, db);
+        if (cacheFd >= 0) close(cacheFd);
+        free(source);
+        return db;
+    }
+
+    struct stat st;
+    int staged = (stat(entry, &st) == 0);
+    if (!staged)
+    {
+        long long size = directorySize(source);
+
+        //the copies in use by other workers cannot be evicted, so there
+        //may still not be room, and then the database is searched in place
+        if (size >= 0 && size <= limit &&
+          evictCacheEntries(cacheDir, size, limit) + size <= limit)
+        {
+            //copy under a temporary name, so a partial copy is never used
+            char tmp[PATH_MAX + 32];
+            snprintf(tmp, sizeof(tmp), "%s.tmp%d", entry, getpid());
+            char *command = malloc(strlen(source) + strlen(tmp) + 16);
+            if (command == NULL) fatal("stageDatabase: malloc failed");
+            sprintf(command, "cp -r %s %s", source, tmp);
+            if (system(command) == 0 && rename(tmp, entry) == 0)
+            {
+                staged = 1;
+            }
+            else
+            {
+                removeDirectory(tmp);
+            }
+            free(command);
+        }
+    }
+
+    char *result = db;
+    if (staged)
+    {
+        //mark the copy as the most recently used
+        utimes(entry, NULL);
+
+        int fd = open(entryLock, O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+        if (fd >= 0 && flock(fd, LOCK_SH) == 0)
+        {
+            *entryLockFd = fd;
+            result = malloc(strlen(entry) + strlen(slash) + 1);
+            if (result == NULL) fatal("stageDatabase: malloc failed");
+            sprintf(result, "%s%s", entry, slash);
+        }
+        else if (fd >= 0)
+        {
+            close(fd);
+        }
+    }
+    if (result == db)
+    {
+        fprintf(stderr, "database %s not cached in %s\n", db, cacheDir);
+    }
+
+    flock(cacheFd, LOCK_UN);
+    close(cacheFd);
+    free(source);
+
+    return result;
+}
+
+//the worker function 
+//
+//agent Oct 2026: when shardCount is greater than one, the database argument
+//at blastArgs[dbArgIndex] is replaced for each block by the name of the
+//shard to be searched, <db>.shard<k>.
+//
+//agent Oct 2026: when candidatesFile is not NULL, the worker receives the
+//whole block before starting blast, builds a database of the candidates of
+//the queries in the block, and points blastArgs[dbArgIndex] at that.
+//
+//agent Oct 2026: when dbCacheDir is not NULL, blastArgs[dbArgIndex] is
+//pointed at the copy of the database in the node-local cache.
+//
+//agent Oct 2026: when rescoring is not NULL, all of blast's output for a
+//block is read, and its e-values recomputed for the whole database, before
+//it is sent to the writer.
+void worker(int rank, char** blastArgs, int compress, int shardCount,
+  int dbArgIndex, char *candidatesFile, char *dbCacheDir,
+  long long dbCacheLimit, Rescoring *rescoring)
+{
+#ifdef DEBUG
+    fprintf(stderr, "worker %d started\n", rank);
+#endif
+    MPI_Status status;  
+    
+    //pipes that will be used
+    int toBlastPipe[2];
+    int fromBlastPipe[2];
+  
+    int blocksSearched = 0;
+
+    int errorCheck;
+ 
+    int tag = BEGIN_TAG;
+ 
+    //buffer that received messages will be placed into
+    char *buffer;
+  
+    buffer = malloc(BUFFER_SIZE);
+    if (buffer == NULL) fatal("worker: malloc failed");
+
+    //the begin message from the scheduler gives the block and shard numbers
+    char taskId[32];
+
+    //search the node-local copy of the database (this must be done before
+    //the shard names are made from the database name)
+    int dbCacheLockFd = -1;
+    if (dbCacheDir != NULL)
+    {
+        blastArgs[dbArgIndex] = stageDatabase(blastArgs[dbArgIndex],
+          dbCacheDir, dbCacheLimit, &dbCacheLockFd);
+    }
+
+    //name of the database shard being searched
+    char *db = NULL;
+    char *shardDb = NULL;
+    int shardDbLength = 0;
+
+    if (shardCount > 1)
+    {
+        db = blastArgs[dbArgIndex];
+        shardDbLength = strlen(db) + 32;
+        shardDb = malloc(shardDbLength);
+        if (shardDb == NULL) fatal("worker: malloc failed");
+    }
+
+    //with candidates: the candidates of each query, the FASTA records of
+    //the database, and the file for the database built for each block
+    NamedTextTable candidates;
+    NamedTextTable dbRecords;
+    char *dbType = NULL;
+    char *restrictedDb = NULL;
+
+    //block received from the scheduler before starting blast
+    char *block = NULL;
+
+    //number of sequences in the database built for the block
+    int restrictedDbCount = 1;
+
+    if (candidatesFile != NULL)
+    {
+        loadCandidates(candidatesFile, &candidates);
+        loadDbRecords(blastArgs[dbArgIndex], &dbRecords);
+
+        //blastn and tblastx search nucleotide databases
+        int n = strlen(blastArgs[0]);
+        if ((n >= 6 && !strcmp(blastArgs[0] + n - 6, "blastn")) ||
+          (n >= 7 && !strcmp(blastArgs[0] + n - 7, "tblastx")))
+        {
+            dbType = "nucl";
+        }
+        else
+        {
+            dbType = "prot";
+        }
+
+        char *tmpDir = getenv("TMPDIR");
+        if (tmpDir == NULL) tmpDir = "/tmp";
+        restrictedDb = malloc(strlen(tmpDir) + 64);
+        if (restrictedDb == NULL) fatal("worker: malloc failed");
+        sprintf(restrictedDb, "%s/mpiBlast-%d-%d", tmpDir, rank, getpid());
+    }
+  
+    //send ready message to scheduler
+    if((errorCheck = MPI_Send("", 1, MPI_CHAR, SCHEDULER_PROCESS, 0,
+      MPI_COMM_WORLD)) != MPI_SUCCESS)
+    {
+        fprintf(stderr, "MPI error sending ready message to scheduler!\n");
+    }
+
+    //receive start message
+    if((errorCheck = MPI_Recv(buffer, BUFFER_SIZE, MPI_CHAR, SCHEDULER_PROCESS,
+      MPI_ANY_TAG, MPI_COMM_WORLD, &status)) != MPI_SUCCESS)
+    {
+        fprintf(stderr, "MPI error receiving start message from scheduler!\n");
+    }
+
+#ifdef DEBUG
+    fprintf(stderr, "worker %d initialized\n", rank);
+#endif
+    tag = status.MPI_TAG;
 
     //if(status.MPI_TAG == COMPLETE_TAG)
     //    return;
  
     while(tag != COMPLETE_TAG)
     { 
+        strncpy(taskId, buffer, sizeof(taskId));
+        taskId[sizeof(taskId) - 1] = 0;
+
+        //point blast at the shard for this task
+        if (shardCount > 1)
+        {
+            int block, shard;
+            if (sscanf(taskId, "%d %d", &block, &shard) != 2)
+            {
+                fatal("worker: bad begin message");
+            }
+            snprintf(shardDb, shardDbLength, "%s.shard%d", db, shard);
+            blastArgs[dbArgIndex] = shardDb;
+        }
+
+        //get the block, and build the database of its candidates
+        if (candidatesFile != NULL)
+        {
+            block = receiveBlock();
+            restrictedDbCount = makeRestrictedDb(block, &candidates,
+              &dbRecords, dbType, restrictedDb);
+            blastArgs[dbArgIndex] = restrictedDb;
+        }
+
         //create toBlast pipe
         if((errorCheck = pipe(toBlastPipe)) == -1)
         {
@@ -640,6 +2383,10 @@ void worker(int rank, char** blastArgs)
               }
             }
 #endif
+            //no candidates for any query in the block, so there is nothing
+            //to search, and the output for the block is empty
+            if (restrictedDbCount == 0) _exit(0);
+
             // does not return if successful
             execvp(blastArgs[0], blastArgs);
             perror("failure in invoking blast tool");
@@ -657,8 +2404,27 @@ void worker(int rank, char** blastArgs)
             close(toBlastPipe[0]);
             close(fromBlastPipe[1]);
       
-            errorCheck = pthread_create(&tid, NULL, workerHelper,
-              (void*)(&(toBlastPipe[1])));
+            //with candidates the block has already been received, so a
+            //different thread feeds it to blast
+            BlockWriterArgs blockWriterArgs;
+            blockWriterArgs.pipe = toBlastPipe[1];
+            blockWriterArgs.block = block;
+
+            if (candidatesFile == NULL)
+            {
+                errorCheck = pthread_create(&tid, NULL, workerHelper,
+                  (void*)(&(toBlastPipe[1])));
+            }
+            else if (restrictedDbCount > 0)
+            {
+                errorCheck = pthread_create(&tid, NULL, blockWriter,
+                  (void*)(&blockWriterArgs));
+            }
+            else
+            {
+                close(toBlastPipe[1]);
+                errorCheck = 0;
+            }
             
             if(errorCheck != 0)
             {
@@ -666,8 +2432,9 @@ void worker(int rank, char** blastArgs)
             }
 
             //send begin tag to writer to establish connection
-            if((errorCheck = MPI_Send("", 1, MPI_CHAR, WRITER_PROCESS,
-              BEGIN_TAG, MPI_COMM_WORLD)) != MPI_SUCCESS)
+            //(passing on the block and shard numbers)
+            if((errorCheck = MPI_Send(taskId, strlen(taskId) + 1, MPI_CHAR,
+              WRITER_PROCESS, BEGIN_TAG, MPI_COMM_WORLD)) != MPI_SUCCESS)
             {
                 fprintf(stderr, "MPI Error sending begin tag to writer\n");
             }
@@ -676,7 +2443,37 @@ void worker(int rank, char** blastArgs)
             int bytesRead = 0;
 
             //read all data from pipe
-            bytesRead = read(fromBlastPipe[0], buffer, BUFFER_SIZE); 
+            //(when compressing or rescoring, the data is sent by
+            //sendCompressedOutput or sendText and this loop is skipped)
+            if (rescoring != NULL)
+            {
+                char *text = NULL;
+                size_t textLength = 0;
+                size_t textAlloc = 0;
+                appendText(&text, &textLength, &textAlloc, "", 0);
+                while ((bytesRead = read(fromBlastPipe[0], buffer,
+                  BUFFER_SIZE)) > 0)
+                {
+                    appendText(&text, &textLength, &textAlloc, buffer,
+                      bytesRead);
+                }
+                if (bytesRead < 0)
+                {
+                    fprintf(stderr, "Read error on blast pipe, errno is %s\n",
+                      strerror(errno));
+                    bytesRead = 0;
+                }
+
+                size_t newLength;
+                char *newText = rescoreHits(text, rescoring, &newLength);
+                sendText(newText, newLength, compress, buffer);
+                free(newText);
+                free(text);
+            }
+            else if (compress)
+                sendCompressedOutput(fromBlastPipe[0], buffer);
+            else
+                bytesRead = read(fromBlastPipe[0], buffer, BUFFER_SIZE - 1); 
       
             while(bytesRead > 0) 
             {
@@ -695,15 +2492,17 @@ void worker(int rank, char** blastArgs)
                 }
    
                 //read more data from pipe
-                bytesRead = read(fromBlastPipe[0], buffer, BUFFER_SIZE);
+                //(leaving room for the null)
+                bytesRead = read(fromBlastPipe[0], buffer, BUFFER_SIZE - 1);
             }    
     
 #ifdef DEBUG
     fprintf(stderr, "worker %d sending end tag to writer\n", rank);
 #endif
             //send end tag to writer to close connection
-            if((errorCheck = MPI_Send("", 1, MPI_CHAR, WRITER_PROCESS, END_TAG,
-              MPI_COMM_WORLD)) != MPI_SUCCESS)
+            if(!compress && rescoring == NULL &&
+              (errorCheck = MPI_Send("", 1, MPI_CHAR,
+              WRITER_PROCESS, END_TAG, MPI_COMM_WORLD)) != MPI_SUCCESS)
             {
                 fprintf(stderr, "Error sending end tag to writer!\n"); 
             }
@@ -713,6 +2512,14 @@ void worker(int rank, char** blastArgs)
             //wait for blast process to terminate
             waitpid(pid, &fStatus, WUNTRACED | WCONTINUED);
 
+            //the block is no longer needed once it has been fed to blast
+            if (candidatesFile != NULL)
+            {
+                if (restrictedDbCount > 0) pthread_join(tid, NULL);
+                free(block);
+                block = NULL;
+            }
+
             //close blast pipe
             close(fromBlastPipe[0]);    
  
@@ -738,6 +2545,19 @@ void worker(int rank, char** blastArgs)
             tag = status.MPI_TAG;
         }
     }
+
+    //remove the database built for the last block
+    if (candidatesFile != NULL)
+    {
+        char *command = malloc(2 * strlen(restrictedDb) + 32);
+        if (command == NULL) fatal("worker: malloc failed");
+        sprintf(command, "rm -f %s %s.*", restrictedDb, restrictedDb);
+        system(command);
+        free(command);
+    }
+
+    //let the copy of the database be evicted
+    if (dbCacheLockFd >= 0) close(dbCacheLockFd);
 }
 
 /*
@@ -747,13 +2567,57 @@ void worker(int rank, char** blastArgs)
  *  -out arguments, which will actually be stripped out and not sent
  *  on to the blast tool.
  *
+ *  The optional -gzip and -frameindex arguments are also stripped out.
+ *
+ *  agent Oct 2026: so is the optional -dbshards argument. -dbshards N says
+ *  that the database has been split into N shards, named <db>.shard0
+ *  through <db>.shard<N-1>, where <db> is the -db argument. Each block of
+ *  queries is then searched against every shard and the writer keeps, for
+ *  each query, the hits for the -max_target_seqs subjects with the best
+ *  bit scores across all the shards. -dbsize and -dbseqs must be given
+ *  with the total length and number of sequences of the database. The
+ *  output format must be -outfmt 6.
+ *
+ *  Blast is given EVALUE_SLACK times the -evalue, and the e-value of each
+ *  hit is recomputed with the effective search space of the whole
+ *  database before the hits are filtered with the real -evalue (see
+ *  rescoreHits), so the e-values are those of an unsharded search. This
+ *  assumes blast's default scoring: blastp with BLOSUM62, gap costs 11/1
+ *  and -comp_based_stats 0, or blastn with the megablast defaults. The
+ *  -dbseqs argument is stripped out.
+ *
+ *  agent Oct 2026: and the optional -candidates argument, which names a file
+ *  written by kmerPrefilter. Each block of queries is then searched only
+ *  against the candidates of those queries. In this case the -db argument
+ *  must be the database FASTA file (the database itself need not be
+ *  formatted), and -dbsize and -dbseqs are required so the e-values can
+ *  be recomputed for the whole database, as for -dbshards (here the shard
+ *  is the set of candidates). -candidates cannot be combined with
+ *  -dbshards.
+ *
+ *  agent Oct 2026: and the optional -dbcache and -dbcachesize arguments.
+ *  -dbcache names a directory in node-local storage where the workers keep
+ *  copies of the databases they search, and -dbcachesize limits the size
+ *  of that directory, in megabytes. The -db argument must name a database
+ *  in a directory of its own, and the name of that directory is the key
+ *  of its copy, so it must change whenever the database does (e.g. by
+ *  being a hash of the database's contents and of the makeblastdb version
+ *  and arguments that formatted it). -dbcache cannot be combined
+ *  with -candidates.
+ *
  */
 
 void usageMessage(void)
 {
   fprintf(stderr,
     "Args: blastCommand -db database -query queryFile -out outputFile "
-    "<any other blast args you want>\n");
+    "[-gzip [-frameindex indexFile]] "
+    "[-dbshards count -dbsize length -dbseqs count] "
+    "[-candidates candidatesFile -dbsize length -dbseqs count] "
+    "[-dbcache directory [-dbcachesize megabytes]] "
+    "<any other blast args you want>\n"
+    "(-dbshards and -candidates require -outfmt 6 and blastp with "
+    "-comp_based_stats 0, or blastn)\n");
   exit(1);
 }
 
@@ -765,16 +2629,31 @@ int main(int argc, char **argv)
 
     char *queryFileName = 0;
     char *outFileName = 0;
+    char *indexFileName = NULL;
+
+    int compress = 0;
+
+    int shardCount = 1;
+
+    char *candidatesFile = NULL;
+
+    char *dbCacheDir = NULL;
+    long long dbCacheLimit = (long long) DB_CACHE_SIZE * 1024 * 1024;
+
+    int dbCount = 0;
 
     // command line to invoke the blast tool
     char **blastArgs;
 
     // malloc an arg array for the blast command
     // not all the slots will be used however
-    blastArgs = malloc(sizeof(char*) * argc);
+    // (there is room for an -evalue argument to be added)
+    blastArgs = malloc(sizeof(char*) * (argc + 2));
     if (blastArgs == NULL) fatal("malloc failed in main\n");
 
     // run through args and pull out the -query and -out args
+    // (and -gzip, -frameindex, -dbshards, -dbseqs, -candidates, -dbcache
+    // and -dbcachesize)
     int i = 1;
     int j = 0;
     while (i < argc)
@@ -789,6 +2668,47 @@ int main(int argc, char **argv)
         outFileName = argv[i+1];
         i += 2;
       }
+      else if (!strcmp(argv[i], "-gzip"))
+      {
+        compress = 1;
+        i += 1;
+      }
+      else if (!strcmp(argv[i], "-frameindex"))
+      {
+        indexFileName = argv[i+1];
+        i += 2;
+      }
+      else if (!strcmp(argv[i], "-dbshards"))
+      {
+        if (i+1 >= argc) usageMessage();
+        shardCount = atoi(argv[i+1]);
+        if (shardCount < 1) usageMessage();
+        i += 2;
+      }
+      else if (!strcmp(argv[i], "-dbseqs"))
+      {
+        if (i+1 >= argc) usageMessage();
+        dbCount = atoi(argv[i+1]);
+        if (dbCount < 1) usageMessage();
+        i += 2;
+      }
+      else if (!strcmp(argv[i], "-candidates"))
+      {
+        candidatesFile = argv[i+1];
+        i += 2;
+      }
+      else if (!strcmp(argv[i], "-dbcache"))
+      {
+        dbCacheDir = argv[i+1];
+        i += 2;
+      }
+      else if (!strcmp(argv[i], "-dbcachesize"))
+      {
+        if (i+1 >= argc) usageMessage();
+        dbCacheLimit = atoll(argv[i+1]) * 1024 * 1024;
+        if (dbCacheLimit <= 0) usageMessage();
+        i += 2;
+      }
       else
       {
         blastArgs[j] = argv[i];
@@ -801,6 +2721,95 @@ int main(int argc, char **argv)
     // make sure that -query and -out were all given
     if (queryFileName == 0 || outFileName == 0) usageMessage();
 
+    // a frame index only makes sense for compressed output
+    if (indexFileName != NULL && !compress) usageMessage();
+
+    // find the args that matter when the database is sharded
+    int dbArgIndex = -1;
+    int maxTargetSeqs = 500;  // the blast default
+    int outputFormatIndex = -1;
+    int evalueIndex = -1;
+    long long dbLength = 0;
+    int otherScoring = 0;
+    int compositionStats = 1;
+    for (i = 0; blastArgs[i] != NULL; i++)
+    {
+      if (blastArgs[i+1] == NULL) break;
+      if (!strcmp(blastArgs[i], "-db")) dbArgIndex = i+1;
+      else if (!strcmp(blastArgs[i], "-max_target_seqs"))
+        maxTargetSeqs = atoi(blastArgs[i+1]);
+      else if (!strcmp(blastArgs[i], "-outfmt")) outputFormatIndex = i+1;
+      else if (!strcmp(blastArgs[i], "-evalue")) evalueIndex = i+1;
+      else if (!strcmp(blastArgs[i], "-dbsize"))
+        dbLength = atoll(blastArgs[i+1]);
+      else if (!strcmp(blastArgs[i], "-comp_based_stats"))
+        compositionStats = strcmp(blastArgs[i+1], "0");
+      else if (!strcmp(blastArgs[i], "-matrix") ||
+        !strcmp(blastArgs[i], "-gapopen") ||
+        !strcmp(blastArgs[i], "-gapextend") ||
+        !strcmp(blastArgs[i], "-reward") ||
+        !strcmp(blastArgs[i], "-penalty") ||
+        !strcmp(blastArgs[i], "-task"))
+        otherScoring = 1;
+    }
+
+    // with -dbshards or -candidates, the e-values are recomputed by the
+    // workers, which needs blast's query lengths and raw scores
+    Rescoring rescoring;
+    Rescoring *rescoringArg = NULL;
+    char relaxedEvalue[32];
+    char rescoringFormat[] = "6 std qlen score";
+    if (shardCount > 1 || candidatesFile != NULL)
+    {
+      int n = strlen(blastArgs[0]);
+      if (n >= 6 && !strcmp(blastArgs[0] + n - 6, "blastp") &&
+          !compositionStats)
+      {
+        rescoring.p = &proteinParameters;
+      }
+      else if (n >= 6 && !strcmp(blastArgs[0] + n - 6, "blastn"))
+      {
+        rescoring.p = &nucleotideParameters;
+      }
+      else
+      {
+        usageMessage();
+      }
+      if (dbArgIndex < 0 || dbLength <= 0 || dbCount == 0 ||
+          outputFormatIndex < 0 ||
+          strcmp(blastArgs[outputFormatIndex], "6") || otherScoring)
+      {
+        usageMessage();
+      }
+      rescoring.dbLength = dbLength;
+      rescoring.dbCount = dbCount;
+      rescoring.threshold = 10;  // the blast default
+      if (evalueIndex >= 0)
+      {
+        rescoring.threshold = strtod(blastArgs[evalueIndex], NULL);
+      }
+      else
+      {
+        blastArgs[j] = "-evalue";
+        evalueIndex = j + 1;
+        blastArgs[j+2] = NULL;
+      }
+      snprintf(relaxedEvalue, sizeof(relaxedEvalue), "%g",
+        rescoring.threshold * EVALUE_SLACK);
+      blastArgs[evalueIndex] = relaxedEvalue;
+      blastArgs[outputFormatIndex] = rescoringFormat;
+      rescoringArg = &rescoring;
+    }
+    if (candidatesFile != NULL && shardCount > 1) usageMessage();
+    if (dbCacheDir != NULL)
+    {
+      if (dbArgIndex < 0 || strchr(blastArgs[dbArgIndex], '/') == NULL ||
+          candidatesFile != NULL)
+      {
+        usageMessage();
+      }
+    }
+
     //initialize MPI
     MPI_Init_thread(&argc, &argv, MPI_THREAD_MULTIPLE, &threadProvided);
 
@@ -812,14 +2821,19 @@ int main(int argc, char **argv)
   
     if(rank == SCHEDULER_PROCESS)
     {
-        scheduler(queryFileName, size);
+        scheduler(queryFileName, size, shardCount);
     }
     else if(rank == WRITER_PROCESS)
     {
-        writer(outFileName);
+        writer(outFileName, indexFileName, compress, shardCount,
+          maxTargetSeqs);
     }
     else
-        worker(rank, blastArgs);
+        // with shards the writer's helper threads do the compressing, after
+        // merging
+        worker(rank, blastArgs, compress && shardCount == 1, shardCount,
+          dbArgIndex, candidatesFile, dbCacheDir, dbCacheLimit,
+          rescoringArg);
 
     MPI_Barrier(MPI_COMM_WORLD);
 
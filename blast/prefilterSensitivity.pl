@@ -0,0 +1,139 @@
+#!/usr/bin/perl
+
+# $Id$
+#
+# Report how well the candidates found by kmerPrefilter cover the
+# high-quality hits found from a full set of pairwise BLASTs.
+#
+# The high-quality hits file is the <prefix>.hits file written by
+# getHighQualityHits.pl: a line for each gene, with the gene first followed
+# by the genes it hits above the threshold. A hit is "found" if the hit
+# gene is on the query gene's line in one of the candidates files.
+#
+# It takes two or more arguments:
+#   1. the high-quality hits file
+#   2. the candidates files written by kmerPrefilter (typically one for
+#      each pair of genomes), named <genome>-<db>.candidates as
+#      doPairwiseBlasts.pl names them
+#
+# The report gives the sensitivity (fraction of high-quality hits that are
+# among the candidates) and the fraction of all query/subject pairs that
+# are candidates (i.e. how much of the all-by-all BLAST is left to do).
+# The number of genes in each genome is taken from the hits file, which has
+# a line for every gene, and the genome names from the gene names
+# (<genome>$<gene>).
+# The high-quality hits that were missed are listed on standard error.
+#
+
+use strict;
+use warnings;
+
+if (@ARGV < 2)
+{
+  die "Usage: prefilterSensitivity.pl hitsFile <list of candidates files>\n";
+}
+
+my $hitsFile = shift @ARGV;
+my @candidateFiles = @ARGV;
+
+# read the high-quality hits, ignoring self-hits
+my %needed = ();
+my $hitCount = 0;
+my %genomeGenes = ();
+open(IN, "<", $hitsFile) or
+  die "cannot open input ($hitsFile)\n";
+while (my $line = <IN>)
+{
+  chomp($line);
+
+  my @piece = split / /, $line;
+  my $gene = shift @piece;
+  if ($gene =~ /^(.*)\$/)
+  {
+    $genomeGenes{$1} += 1;
+  }
+  foreach my $hit (@piece)
+  {
+    if ($hit ne $gene && !defined($needed{$gene}{$hit}))
+    {
+      $needed{$gene}{$hit} = 0;
+      $hitCount += 1;
+    }
+  }
+}
+close(IN);
+
+# mark the hits that are among the candidates
+my $foundCount = 0;
+my $candidateCount = 0;
+my $pairCount = 0;
+foreach my $file (@candidateFiles)
+{
+  # find the two genomes from the file name (genome names may contain
+  # hyphens, so try each known genome as the query genome)
+  my $name = $file;
+  $name =~ s/^.*\///;
+  $name =~ s/\.candidates$//;
+  my $pairs;
+  foreach my $genome (keys %genomeGenes)
+  {
+    if (index($name, "$genome-") == 0)
+    {
+      my $db = substr($name, length($genome) + 1);
+      if (defined($genomeGenes{$db}))
+      {
+        $pairs = $genomeGenes{$genome} * $genomeGenes{$db};
+        last;
+      }
+    }
+  }
+  if (!defined($pairs))
+  {
+    die "cannot find the genomes of $file in $hitsFile\n";
+  }
+  $pairCount += $pairs;
+
+  open(IN, "<", $file) or
+    die "cannot open input ($file)\n";
+  my $fileQueries = 0;
+  while (my $line = <IN>)
+  {
+    chomp($line);
+
+    my @piece = split / /, $line;
+    my $gene = shift @piece;
+    $fileQueries += 1;
+    $candidateCount += @piece;
+
+    my $hits = $needed{$gene};
+    foreach my $candidate (@piece)
+    {
+      if (defined($hits) && defined($hits->{$candidate}) &&
+          $hits->{$candidate} == 0)
+      {
+        $hits->{$candidate} = 1;
+        $foundCount += 1;
+      }
+    }
+  }
+  close(IN);
+  print "$file: $fileQueries queries\n";
+}
+
+# report the misses
+foreach my $gene (sort keys %needed)
+{
+  foreach my $hit (sort keys %{$needed{$gene}})
+  {
+    if ($needed{$gene}{$hit} == 0)
+    {
+      print STDERR "missed: $gene $hit\n";
+    }
+  }
+}
+
+printf "high-quality hits: %d, found among candidates: %d (%.2f%%)\n",
+  $hitCount, $foundCount,
+  ($hitCount > 0) ? 100.0 * $foundCount / $hitCount : 0;
+printf "candidate pairs: %d of %d (%.2f%%)\n", $candidateCount, $pairCount,
+  ($pairCount > 0) ? 100.0 * $candidateCount / $pairCount : 0;
@@ -0,0 +1,471 @@
+/*
+ * $Id$
+ *
+ * Compute the score of each sequence's alignment with itself, which is
+ * what the self BLAST of a genome was used for: the .self file gives the
+ * bit score used to scale the Lerat bit scores, and the .errors file lists
+ * the genes that would not have a self-hit.
+ *
+ * Every residue scores positively against itself (except ambiguity codes),
+ * so the best local self-alignment is the best ungapped segment of the
+ * main diagonal, which is found in one pass over the sequence. The raw
+ * score is converted to a bit score and an e-value with the gapped
+ * Karlin-Altschul parameters that blastp (BLOSUM62, gap costs 11/1) and
+ * blastn (megablast, reward 1, penalty -2) use, and with the same
+ * effective lengths, where the database is the sequence file itself.
+ * A gene is an error when its e-value is above the threshold, since BLAST
+ * would not have reported its self-hit.
+ *
+ * The bit scores are those of BLAST without composition-based statistics,
+ * which blastp applies by default, so doPairwiseBlasts.pl runs blastp with
+ * -comp_based_stats 0 to score the other hits the same way.
+ *
+ * Usage: selfScore [-n] [-threads count] sequenceFile evalueThreshold
+ *          selfFile errorsFile
+ *
+ *   -n       the sequences are nucleotides (the default is proteins)
+ *   -threads number of threads used to score the sequences
+ *
+ * The sequence file is a FASTA file, and the sequence name is the text
+ * between the > and the first white space of the header. The self file
+ * has a line for each non-error sequence, giving its name and bit score,
+ * separated by a space. The errors file has the name of each error
+ * sequence on its own line.
+ *
+ * This must be compiled with -pthread and linked with -lm.
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+
+#define DEFAULT_THREADS 4
+
+/*
+ * Karlin-Altschul parameters for a scoring system.
+ */
+typedef struct
+{
+    double lambda;
+    double k;
+    double alpha;
+    double beta;
+} KarlinParameters;
+
+// BLOSUM62 with gap costs 11/1 (the blastp default)
+static const KarlinParameters proteinParameters = { 0.267, 0.041, 1.9, -30 };
+
+// reward 1, penalty -2, linear gap costs (the megablast default)
+static const KarlinParameters nucleotideParameters = { 1.28, 0.46, 1.5, -2 };
+
+#define NUCLEOTIDE_MATCH 1
+#define NUCLEOTIDE_MISMATCH -2
+
+/*
+ * A set of sequences read from a FASTA file.
+ */
+typedef struct
+{
+    int count;
+    char **names;
+    char **residues;
+    int *lengths;
+} SequenceSet;
+
+/*
+ * What each thread needs to score its share of the sequences.
+ */
+typedef struct
+{
+    int first;             // the thread does sequences first, first+step, ...
+    int step;
+    SequenceSet *set;
+    int *scores;           // raw self score for each sequence
+} ThreadArgs;
+
+// the score of each residue against itself
+static int selfScore[256];
+
+/*
+ * Called upon a fatal error
+ */
+void fatal(char *message)
+{
+    fprintf(stderr, "%s\n", message);
+    exit(-1);
+}
+
+void usageMessage(void)
+{
+    fprintf(stderr,
+      "Usage: selfScore [-n] [-threads count] sequenceFile evalueThreshold "
+      "selfFile errorsFile\n");
+    exit(1);
+}
+
+/*
+ * Set up the self score of each residue. For proteins these are the
+ * diagonal of BLOSUM62, as distributed with BLAST. Unknown residues are
+ * scored like X.
+ */
+void initScores(int nucleotides)
+{
+    int i;
+
+    if (nucleotides)
+    {
+        const char *letters = "ACGT";
+        for (i = 0; i < 256; i++) selfScore[i] = NUCLEOTIDE_MISMATCH;
+        for (i = 0; i < 4; i++)
+        {
+            selfScore[(int) letters[i]] = NUCLEOTIDE_MATCH;
+            selfScore[tolower(letters[i])] = NUCLEOTIDE_MATCH;
+        }
+    }
+    else
+    {
+        const char *letters = "ARNDCQEGHILKMFPSTWYVBJZX*";
+        const int diagonal[] =
+          { 4, 5, 6, 6, 9, 5, 5, 6, 8, 4, 4, 5, 5, 6, 7, 4, 5, 11, 7, 4,
+            4, 3, 4, -1, 1 };
+        for (i = 0; i < 256; i++) selfScore[i] = -1;
+        for (i = 0; letters[i] != 0; i++)
+        {
+            selfScore[(int) letters[i]] = diagonal[i];
+            selfScore[tolower(letters[i])] = diagonal[i];
+        }
+    }
+}
+
+/*
+ * Read all the sequences in a FASTA file.
+ */
+void readSequences(const char *filename, SequenceSet *set)
+{
+    FILE *fp = fopen(filename, "r");
+    if (fp == NULL)
+    {
+        fprintf(stderr, "cannot open input (%s)\n", filename);
+        exit(EXIT_FAILURE);
+    }
+
+    int allocCount = 1024;
+    set->count = 0;
+    set->names = malloc(sizeof(char *) * allocCount);
+    set->residues = malloc(sizeof(char *) * allocCount);
+    set->lengths = malloc(sizeof(int) * allocCount);
+    if (set->names == NULL || set->residues == NULL || set->lengths == NULL)
+    {
+        fatal("readSequences: malloc failed");
+    }
+
+    int seqAlloc = 0;
+    char *line = NULL;
+    size_t lineAlloc = 0;
+    ssize_t n;
+    while ((n = getline(&line, &lineAlloc, fp)) != -1)
+    {
+        if (line[0] == '>')
+        {
+            if (set->count == allocCount)
+            {
+                allocCount *= 2;
+                set->names = realloc(set->names, sizeof(char *) * allocCount);
+                set->residues = realloc(set->residues,
+                  sizeof(char *) * allocCount);
+                set->lengths = realloc(set->lengths, sizeof(int) * allocCount);
+                if (set->names == NULL || set->residues == NULL ||
+                  set->lengths == NULL)
+                {
+                    fatal("readSequences: realloc failed");
+                }
+            }
+
+            // the name is everything up to the first white space
+            char *start = line + 1;
+            while (*start == ' ' || *start == '\t') start++;
+            int len = strcspn(start, " \t\r\n");
+            set->names[set->count] = strndup(start, len);
+
+            seqAlloc = 1024;
+            set->residues[set->count] = malloc(seqAlloc);
+            if (set->residues[set->count] == NULL)
+            {
+                fatal("readSequences: malloc failed");
+            }
+            set->residues[set->count][0] = 0;
+            set->lengths[set->count] = 0;
+            set->count += 1;
+        }
+        else
+        {
+            if (set->count == 0)
+            {
+                fprintf(stderr, "%s does not start with a FASTA header\n",
+                  filename);
+                exit(EXIT_FAILURE);
+            }
+            int s = set->count - 1;
+            int i;
+            for (i = 0; i < n; i++)
+            {
+                if (isspace((unsigned char) line[i])) continue;
+                if (set->lengths[s] + 2 > seqAlloc)
+                {
+                    seqAlloc *= 2;
+                    set->residues[s] = realloc(set->residues[s], seqAlloc);
+                    if (set->residues[s] == NULL)
+                    {
+                        fatal("readSequences: realloc failed");
+                    }
+                }
+                set->residues[s][set->lengths[s]] = line[i];
+                set->lengths[s] += 1;
+            }
+            set->residues[s][set->lengths[s]] = 0;
+        }
+    }
+    free(line);
+    fclose(fp);
+}
+
+/*
+ * Thread body: find the best diagonal segment of a share of the sequences.
+ */
+void *scoreSequences(void *arg)
+{
+    ThreadArgs *args = arg;
+    SequenceSet *set = args->set;
+
+    int s;
+    for (s = args->first; s < set->count; s += args->step)
+    {
+        const unsigned char *seq = (const unsigned char *) set->residues[s];
+        int best = 0;
+        int current = 0;
+        int i;
+        for (i = 0; i < set->lengths[s]; i++)
+        {
+            current += selfScore[seq[i]];
+            if (current < 0) current = 0;
+            if (current > best) best = current;
+        }
+        args->scores[s] = best;
+    }
+
+    return NULL;
+}
+
+/*
+ * Compute the length adjustment for a query, which is subtracted from the
+ * query length and from the length of each database sequence to get the
+ * effective search space. This follows BLAST_ComputeLengthAdjustment in
+ * the NCBI toolkit, so that the e-values match those reported by BLAST.
+ */
+int lengthAdjustment(const KarlinParameters *p, int queryLength,
+  long long dbLength, int dbCount)
+{
+    const int maxIterations = 20;
+    double m = queryLength;
+    double n = dbLength;
+    double N = dbCount;
+    double logK = log(p->k);
+    double alphaDLambda = p->alpha / p->lambda;
+    double ellMin = 0;
+    double ellMax;
+    double ellNext = 0;
+    double ell;
+    double ss;
+    int converged = 0;
+    int i;
+
+    double a = N;
+    double mb = m * N + n;
+    double c = n * m - (m > 1.0 / p->k ? m : 1.0 / p->k) / p->k;
+    if (c < 0) return 0;
+    ellMax = 2 * c / (mb + sqrt(mb * mb - 4 * a * c));
+
+    for (i = 1; i <= maxIterations; i++)
+    {
+        ell = ellNext;
+        ss = (m - ell) * (n - N * ell);
+        double ellBar = alphaDLambda * (logK + log(ss)) + p->beta;
+        if (ellBar >= ell)
+        {
+            ellMin = ell;
+            if (ellBar - ellMin <= 1.0)
+            {
+                converged = 1;
+                break;
+            }
+            if (ellMin == ellMax) break;
+        }
+        else
+        {
+            ellMax = ell;
+        }
+        if (ellMin <= ellBar && ellBar <= ellMax)
+        {
+            ellNext = ellBar;
+        }
+        else
+        {
+            ellNext = (i == 1) ? ellMax : (ellMin + ellMax) / 2;
+        }
+    }
+
+    int adjustment = (int) ellMin;
+    if (converged)
+    {
+        ell = ceil(ellMin);
+        if (ell <= ellMax)
+        {
+            ss = (m - ell) * (n - N * ell);
+            if (alphaDLambda * (logK + log(ss)) + p->beta >= ell)
+            {
+                adjustment = (int) ell;
+            }
+        }
+    }
+    return adjustment;
+}
+
+/*
+ * Format a bit score the way BLAST's tabular output does.
+ */
+void formatBitScore(double bitScore, char *buffer, int size)
+{
+    if (bitScore > 99999)
+    {
+        snprintf(buffer, size, "%.3e", bitScore);
+    }
+    else if (bitScore > 99.9)
+    {
+        // BLAST truncates these rather than rounding them
+        snprintf(buffer, size, "%ld", (long) bitScore);
+    }
+    else
+    {
+        snprintf(buffer, size, "%.1f", bitScore);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int nucleotides = 0;
+    int threadCount = DEFAULT_THREADS;
+
+    int i = 1;
+    while (i < argc && argv[i][0] == '-')
+    {
+        if (!strcmp(argv[i], "-n"))
+        {
+            nucleotides = 1;
+            i += 1;
+        }
+        else if (!strcmp(argv[i], "-threads") && i + 1 < argc)
+        {
+            threadCount = atoi(argv[i+1]);
+            if (threadCount < 1) usageMessage();
+            i += 2;
+        }
+        else
+        {
+            usageMessage();
+        }
+    }
+    if (argc - i != 4) usageMessage();
+
+    char *sequenceFileName = argv[i];
+    char *end;
+    double evalueThreshold = strtod(argv[i+1], &end);
+    if (*end != 0 || evalueThreshold < 0) usageMessage();
+    char *selfFileName = argv[i+2];
+    char *errorsFileName = argv[i+3];
+
+    const KarlinParameters *p =
+      nucleotides ? &nucleotideParameters : &proteinParameters;
+
+    initScores(nucleotides);
+
+    SequenceSet set;
+    readSequences(sequenceFileName, &set);
+
+    long long dbLength = 0;
+    for (i = 0; i < set.count; i++) dbLength += set.lengths[i];
+
+    int *scores = malloc(sizeof(int) * (set.count + 1));
+    pthread_t *tids = malloc(sizeof(pthread_t) * threadCount);
+    ThreadArgs *args = malloc(sizeof(ThreadArgs) * threadCount);
+    if (scores == NULL || tids == NULL || args == NULL)
+    {
+        fatal("main: malloc failed");
+    }
+
+    // the sequences are dealt out round-robin to the threads
+    int t;
+    for (t = 0; t < threadCount; t++)
+    {
+        args[t].first = t;
+        args[t].step = threadCount;
+        args[t].set = &set;
+        args[t].scores = scores;
+        if (pthread_create(&tids[t], NULL, scoreSequences, &args[t]) != 0)
+        {
+            fatal("main: pthread_create failed");
+        }
+    }
+    for (t = 0; t < threadCount; t++)
+    {
+        pthread_join(tids[t], NULL);
+    }
+
+    FILE *selfFp = fopen(selfFileName, "w");
+    if (selfFp == NULL)
+    {
+        fprintf(stderr, "cannot open output (%s)\n", selfFileName);
+        exit(EXIT_FAILURE);
+    }
+    FILE *errorsFp = fopen(errorsFileName, "w");
+    if (errorsFp == NULL)
+    {
+        fprintf(stderr, "cannot open output (%s)\n", errorsFileName);
+        exit(EXIT_FAILURE);
+    }
+
+    // write the scores, in sequence order
+    int errorCount = 0;
+    for (i = 0; i < set.count; i++)
+    {
+        int adjustment =
+          lengthAdjustment(p, set.lengths[i], dbLength, set.count);
+        double m = set.lengths[i] - adjustment;
+        double n = dbLength - (double) set.count * adjustment;
+        if (m < 1) m = 1;
+        if (n < 1) n = 1;
+        double evalue = p->k * m * n * exp(-p->lambda * scores[i]);
+
+        if (scores[i] == 0 || evalue > evalueThreshold)
+        {
+            fprintf(errorsFp, "%s\n", set.names[i]);
+            errorCount += 1;
+        }
+        else
+        {
+            char buffer[32];
+            double bitScore =
+              (p->lambda * scores[i] - log(p->k)) / log(2.0);
+            formatBitScore(bitScore, buffer, sizeof(buffer));
+            fprintf(selfFp, "%s %s\n", set.names[i], buffer);
+        }
+    }
+    if (fclose(selfFp) != 0) fatal("main: write of self file failed");
+    if (fclose(errorsFp) != 0) fatal("main: write of errors file failed");
+
+    fprintf(stderr, "%d sequences, %d errors\n", set.count, errorCount);
+
+    return 0;
+}
@@ -0,0 +1,850 @@
+#!/usr/bin/perl
+
+# $Id$
+#
+# agent, October 2026
+#
+# Run the whole analysis of the sample run (see README.md): the BLASTs
+# (doPairwiseBlasts.pl), the Lerat family analysis
+# (doAllGenomesAtOnceLeratAnalysis.pl) and the steps of the Ka/Ks analysis
+# (doKaKsAnalysis.sh), as a set of stages.
+#
+# For each stage the script records, in the file pipeline.state, a hash of
+# the stage's parameters and of the contents of its input files, and a hash
+# of the contents of its output files. A stage whose inputs, parameters and
+# outputs have not changed since it last completed is skipped. So after a
+# crash, or after a change to some input or parameter, running this script
+# again picks up at the first stage that is out of date.
+#
+# A stage depends on the stages that produce its inputs, and stages that do
+# not depend on each other are run in parallel. The Ka/Ks steps that run an
+# external program for each family (clustalw2, alignNAbyAA.pl, cons, dnaml
+# and codeml) are also fanned out: the step's script is run separately for
+# each family, in a directory of its own, and the results are then gathered
+# into the directory the script would have created. No more than the given
+# number of cores are used at once (the BLAST stage counts as using as many
+# cores as the MPI processes it is given, and the alignment of the amino
+# acid families by familyAlign, which uses threads, as using all of them).
+#
+# When the script finishes, the file pipeline.report gives, for each stage,
+# whether it was run or skipped, the number of jobs it took, its elapsed
+# and CPU times, and the total size of its input and output files. The
+# output of each stage is written to pipeline-logs/<stage>.log.
+#
+# It takes six arguments (and an optional leading -cores N, which defaults
+# to the number of cores on this machine, and an optional leading
+# -familyAlign, which aligns the amino acid families with familyAlign
+# rather than with clustalw2):
+#   1. evalue threshold to be passed to doPairwiseBlasts.pl
+#   2. number of MPI processes to be used for the BLASTs
+#   3. MPI machine file
+#   4. Lerat scaled bit score threshold (the families are reciprocal)
+#   5. prefix for the Lerat output (e.g. point7)
+#   6. extension of the family file to be analyzed for Ka/Ks
+#      (e.g. panorthologs)
+#
+# It must be run in a directory laid out like sample-run: with the
+# directories proteins and nuc and the file genome-order, which lists the
+# genomes to be analyzed. The BLAST results are put into the blast
+# directory, the family analysis into <prefix> and the Ka/Ks analysis into
+# KaKs-<prefix>-<extension>.
+#
+# doPairwiseBlasts.pl is incremental: it only does the BLASTs of the
+# genomes that are not yet listed in blast/DONE. So the file
+# blast/pipeline-genomes records, for each genome, a hash of its proteins
+# and of the evalue threshold it was BLASTed with. Before the BLASTs are
+# run, a genome whose proteins or threshold have changed, or whose BLAST
+# results are missing, is removed from blast/DONE and its results are
+# deleted, so that its BLASTs are redone.
+
+use strict;
+use warnings;
+
+use POSIX;
+use Cwd;
+use Digest::MD5;
+use File::Basename;
+use Time::HiRes qw(time);
+
+my $cores = `nproc 2>/dev/null`;
+chomp($cores);
+if ($cores !~ /^[1-9][0-9]*$/)
+{
+  $cores = 1;
+}
+
+my $useFamilyAlign = 0;
+
+while (@ARGV > 0 && ($ARGV[0] eq "-cores" || $ARGV[0] eq "-familyAlign"))
+{
+  my $option = shift @ARGV;
+  if ($option eq "-familyAlign")
+  {
+    $useFamilyAlign = 1;
+    next;
+  }
+  $cores = shift @ARGV;
+  if (!defined($cores) || $cores !~ /^[1-9][0-9]*$/)
+  {
+    die "-cores must be followed by a positive integer\n";
+  }
+}
+
+if (@ARGV != 6)
+{
+  die "Usage: runPipeline.pl [-cores N] [-familyAlign] evalueThreshold " .
+    "numberOfProcessors machinefile leratThreshold prefix familyExtension\n";
+}
+
+my $evalueThreshold = shift @ARGV;
+my $numberOfProcessors = shift @ARGV;
+my $machinefile = shift @ARGV;
+my $leratThreshold = shift @ARGV;
+my $prefix = shift @ARGV;
+my $extension = shift @ARGV;
+
+my $stateFile = "pipeline.state";
+my $reportFile = "pipeline.report";
+my $logDirectory = "pipeline-logs";
+my $workDirectory = "pipeline-work";
+
+# read the genomes to be analyzed
+my @genomes = ();
+open(IN, "<", "genome-order") or
+  die "cannot open input (genome-order)\n";
+while (my $genome = <IN>)
+{
+  chomp($genome);
+  if ($genome ne "")
+  {
+    push @genomes, $genome;
+  }
+}
+close(IN);
+if (@genomes < 2)
+{
+  die "genome-order must list at least two genomes\n";
+}
+
+# the machinefile is given to mpiexec from the blast directory
+$machinefile = Cwd::abs_path($machinefile);
+if (!defined($machinefile) || ! -f $machinefile)
+{
+  die "cannot open machinefile provided for MPI\n";
+}
+
+###########################################################################
+# The stages. Each stage has:
+#   name: used in the state file, the report and the log file
+#   dir: directory in which the command is run
+#   command: shell command (or a sub that returns one when the stage runs)
+#   params: what, besides the inputs, determines the outputs
+#   inputs: files and directories read by the stage
+#   outputs: files and directories written by the stage
+#   fanout: (optional) directories whose files are split up by family
+#   cores: (optional) number of cores the stage uses
+#   keepOutputs: (optional) do not remove the outputs before running
+# All the paths are relative to the directory the script is run in.
+###########################################################################
+
+my @stages = ();
+
+# the BLASTs
+my @blastInputs = ();
+my @blastOutputs = ();
+foreach my $genome (@genomes)
+{
+  push @blastInputs, "proteins/$genome.proteins";
+  push @blastOutputs, "blast/$genome.self", "blast/$genome.errors";
+  foreach my $otherGenome (@genomes)
+  {
+    push @blastOutputs, "blast/$genome-$otherGenome.blast";
+  }
+}
+
+push @stages,
+{
+  name => "blast",
+  dir => ".",
+  command => \&blastCommand,
+  params => "doPairwiseBlasts.pl $evalueThreshold",
+  inputs => \@blastInputs,
+  outputs => \@blastOutputs,
+  cores => $numberOfProcessors,
+  keepOutputs => 1,
+};
+
+# the family analysis
+push @stages,
+{
+  name => "lerat",
+  dir => ".",
+  command => "doAllGenomesAtOnceLeratAnalysis.pl -lerat $leratThreshold " .
+    "-reciprocal blast $prefix @genomes",
+  inputs => \@blastOutputs,
+  outputs => [ $prefix ],
+};
+
+# the Ka/Ks analysis, following doKaKsAnalysis.sh
+my $k = "KaKs-$prefix-$extension";
+my $p = $prefix;
+
+push @stages,
+{
+  name => "kaks-setup",
+  dir => ".",
+  command => "mkdir -p $k && cp $p/$p.$extension $k/",
+  inputs => [ "$p/$p.$extension" ],
+  outputs => [ "$k/$p.$extension" ],
+};
+
+push @stages,
+{
+  name => "fasta-NA",
+  dir => $k,
+  command => "makeFastaByFamily2.pl $p.$extension ../genome-order nuc ../nuc $p",
+  inputs => [ "$k/$p.$extension", "genome-order",
+              map { "nuc/$_.nuc" } @genomes ],
+  outputs => [ "$k/$p-NA" ],
+};
+
+push @stages,
+{
+  name => "fasta-AA",
+  dir => $k,
+  command => "makeFastaByFamily2.pl $p.$extension ../genome-order proteins " .
+    "../proteins $p",
+  inputs => [ "$k/$p.$extension", "genome-order",
+              map { "proteins/$_.proteins" } @genomes ],
+  outputs => [ "$k/$p-AA" ],
+};
+
+if ($useFamilyAlign)
+{
+  push @stages,
+  {
+    name => "align-AA",
+    dir => $k,
+    command => "familyAlign -threads $cores $p-AA",
+    inputs => [ "$k/$p-AA" ],
+    outputs => [ "$k/$p-AA-aligned" ],
+    cores => $cores,
+  };
+}
+else
+{
+  push @stages,
+  {
+    name => "align-AA",
+    dir => $k,
+    command => "alignAllFamilies.pl fasta $p-AA",
+    inputs => [ "$k/$p-AA" ],
+    outputs => [ "$k/$p-AA-aligned" ],
+    fanout => [ "$k/$p-AA" ],
+  };
+}
+
+push @stages,
+{
+  name => "align-NA",
+  dir => $k,
+  command => "alignAllNAbyAAFamilies.pl $p-NA $p-AA-aligned",
+  inputs => [ "$k/$p-NA", "$k/$p-AA-aligned" ],
+  outputs => [ "$k/$p-NA-aligned" ],
+  fanout => [ "$k/$p-NA", "$k/$p-AA-aligned" ],
+};
+
+push @stages,
+{
+  name => "trim",
+  dir => $k,
+  command => "trimAlignedEdges.pl $p-AA-aligned $p-NA-aligned",
+  inputs => [ "$k/$p-AA-aligned", "$k/$p-NA-aligned" ],
+  outputs => [ "$k/$p-AA-aligned-edged", "$k/$p-NA-aligned-edged" ],
+};
+
+push @stages,
+{
+  name => "consensus",
+  dir => $k,
+  command => "consensusAllFamilies.pl $p-AA-aligned-edged",
+  inputs => [ "$k/$p-AA-aligned-edged" ],
+  outputs => [ "$k/$p-AA-aligned-edged-consensus" ],
+  fanout => [ "$k/$p-AA-aligned-edged" ],
+};
+
+push @stages,
+{
+  name => "maxdiff",
+  dir => $k,
+  command => "maxDiffFromConsensus.pl $p-AA-aligned-edged " .
+    "$p-AA-aligned-edged-consensus $p-maxdiff",
+  inputs => [ "$k/$p-AA-aligned-edged", "$k/$p-AA-aligned-edged-consensus" ],
+  outputs => [ "$k/$p-maxdiff" ],
+};
+
+push @stages,
+{
+  name => "rename",
+  dir => $k,
+  command => "replaceGeneNames2.pl nuc $p-NA-aligned-edged",
+  inputs => [ "$k/$p-NA-aligned-edged" ],
+  outputs => [ "$k/$p-NA-aligned-edged-renamed" ],
+};
+
+push @stages,
+{
+  name => "trees",
+  dir => $k,
+  command => "phylipFormatAllFamilies3.pl $p-NA-aligned-edged-renamed",
+  inputs => [ "$k/$p-NA-aligned-edged-renamed" ],
+  outputs => [ "$k/$p-NA-aligned-edged-renamed-trees" ],
+  fanout => [ "$k/$p-NA-aligned-edged-renamed" ],
+};
+
+push @stages,
+{
+  name => "codeml",
+  dir => $k,
+  command => "codemlAllFamilies.pl $p-NA-aligned-edged-renamed " .
+    "$p-NA-aligned-edged-renamed-trees",
+  inputs => [ "$k/$p-NA-aligned-edged-renamed",
+              "$k/$p-NA-aligned-edged-renamed-trees" ],
+  outputs => [ "$k/$p-NA-aligned-edged-renamed-codeml" ],
+  fanout => [ "$k/$p-NA-aligned-edged-renamed",
+              "$k/$p-NA-aligned-edged-renamed-trees" ],
+};
+
+push @stages,
+{
+  name => "csv",
+  dir => $k,
+  command => "codeml2csvAllInfo3.pl $p-NA-aligned-edged-renamed-codeml " .
+    "$p.$extension ../genome-order $p-maxdiff >$p.csv",
+  inputs => [ "$k/$p-NA-aligned-edged-renamed-codeml", "$k/$p.$extension",
+              "genome-order", "$k/$p-maxdiff" ],
+  outputs => [ "$k/$p.csv" ],
+};
+
+# The BLAST command. A genome listed in blast/DONE is first removed from
+# it, along with its BLAST results, if its proteins or the evalue threshold
+# are not those recorded in blast/pipeline-genomes, or if any of its
+# results are missing. Then only the genomes that are not done are BLASTed,
+# and the record is updated once they are. (Genomes in blast/DONE that are
+# not in genome-order are left alone, since their results are not used.)
+sub blastCommand
+{
+  my %blasted = ();
+  if (open(RECORD, "<", "blast/pipeline-genomes"))
+  {
+    while (my $line = <RECORD>)
+    {
+      chomp($line);
+      my ($genome, $signature) = split / /, $line;
+      $blasted{$genome} = $signature;
+    }
+    close(RECORD);
+  }
+
+  my @done = ();
+  if (open(DONE, "<", "blast/DONE"))
+  {
+    while (my $genome = <DONE>)
+    {
+      chomp($genome);
+      push @done, $genome;
+    }
+    close(DONE);
+  }
+  my %done = map { $_ => 1 } @done;
+
+  my %signature = ();
+  foreach my $genome (@genomes)
+  {
+    my ($proteinsHash) = hashPath("proteins/$genome.proteins");
+    $signature{$genome} =
+      Digest::MD5::md5_hex("$evalueThreshold $proteinsHash");
+  }
+
+  # find the genomes whose BLASTs must be redone
+  my %stale = ();
+  foreach my $genome (grep { $done{$_} } @genomes)
+  {
+    if (!defined($blasted{$genome}) ||
+        $blasted{$genome} ne $signature{$genome})
+    {
+      $stale{$genome} = 1;
+    }
+    foreach my $output ("blast/$genome.self", "blast/$genome.errors",
+      map { "blast/$genome-$_.blast" } grep { $done{$_} } @genomes)
+    {
+      $stale{$genome} = 1 if (! -f $output);
+    }
+  }
+
+  if (%stale)
+  {
+    open(DONE, ">", "blast/DONE.tmp") or
+      die "cannot open output (blast/DONE.tmp)\n";
+    foreach my $genome (grep { !$stale{$_} } @done)
+    {
+      print DONE "$genome\n";
+    }
+    close(DONE);
+    rename("blast/DONE.tmp", "blast/DONE") or
+      die "rename of blast/DONE.tmp to blast/DONE failed!\n";
+
+    foreach my $genome (sort keys %stale)
+    {
+      print "  redoing the BLASTs of $genome, since its proteins, the " .
+        "evalue threshold or its results have changed\n";
+      unlink("blast/$genome.prepared", "blast/$genome.self",
+        "blast/$genome.errors");
+      foreach my $other (@done)
+      {
+        unlink("blast/$genome-$other.blast", "blast/$other-$genome.blast");
+      }
+      delete $done{$genome};
+    }
+  }
+
+  # the record, once the BLASTs are done, for all the genomes in DONE
+  mkdir("blast");
+  open(RECORD, ">", "blast/pipeline-genomes.new") or
+    die "cannot open output (blast/pipeline-genomes.new)\n";
+  foreach my $genome (sort keys %blasted)
+  {
+    if ($done{$genome} && !defined($signature{$genome}))
+    {
+      print RECORD "$genome $blasted{$genome}\n";
+    }
+  }
+  foreach my $genome (@genomes)
+  {
+    print RECORD "$genome $signature{$genome}\n";
+  }
+  close(RECORD);
+  my $record = "mv blast/pipeline-genomes.new blast/pipeline-genomes";
+
+  my @newGenomes = grep { !$done{$_} } @genomes;
+  if (@newGenomes == 0)
+  {
+    print "  all genomes are listed in blast/DONE and up to date\n";
+    return $record;
+  }
+
+  return "touch blast/DONE && " .
+    "doPairwiseBlasts.pl proteins blast $evalueThreshold " .
+    "$numberOfProcessors $machinefile @newGenomes && $record";
+}
+
+###########################################################################
+# Hashing
+###########################################################################
+
+# Return the hash of the contents of a file or directory (a directory's
+# hash covers the names and contents of everything in it), and its size.
+sub hashPath
+{
+  my $path = $_[0];
+
+  if (-d $path)
+  {
+    opendir(my $dh, $path) or
+      die "cannot open directory ($path)\n";
+    my @entries = sort grep { $_ ne "." && $_ ne ".." } readdir($dh);
+    closedir($dh);
+
+    my $digest = Digest::MD5->new;
+    my $size = 0;
+    foreach my $entry (@entries)
+    {
+      my ($entryHash, $entrySize) = hashPath("$path/$entry");
+      $digest->add("$entry $entryHash\n");
+      $size += $entrySize;
+    }
+    return ($digest->hexdigest, $size);
+  }
+  elsif (-f $path)
+  {
+    open(my $fh, "<", $path) or
+      die "cannot open input ($path)\n";
+    binmode($fh);
+    my $digest = Digest::MD5->new;
+    $digest->addfile($fh);
+    close($fh);
+    return ($digest->hexdigest, -s $path);
+  }
+  else
+  {
+    return ("missing", 0);
+  }
+}
+
+# Return the combined hash and total size of a list of paths.
+sub hashPaths
+{
+  my @paths = @_;
+
+  my $digest = Digest::MD5->new;
+  my $size = 0;
+  foreach my $path (@paths)
+  {
+    my ($pathHash, $pathSize) = hashPath($path);
+    $digest->add("$path $pathHash\n");
+    $size += $pathSize;
+  }
+  return ($digest->hexdigest, $size);
+}
+
+###########################################################################
+# State and report
+###########################################################################
+
+# stage name -> "signature outputHash" from the last successful run
+my %state = ();
+if (open(STATE, "<", $stateFile))
+{
+  while (my $line = <STATE>)
+  {
+    chomp($line);
+    my ($name, $signature, $outputHash) = split /\t/, $line;
+    $state{$name} = "$signature $outputHash";
+  }
+  close(STATE);
+}
+
+sub writeState
+{
+  open(STATE, ">", "$stateFile.tmp") or
+    die "cannot open output ($stateFile.tmp)\n";
+  foreach my $stage (@stages)
+  {
+    if (defined($state{$stage->{name}}))
+    {
+      my ($signature, $outputHash) = split / /, $state{$stage->{name}};
+      print STATE "$stage->{name}\t$signature\t$outputHash\n";
+    }
+  }
+  close(STATE);
+  rename("$stateFile.tmp", $stateFile) or
+    die "rename of $stateFile.tmp to $stateFile failed!\n";
+}
+
+sub writeReport
+{
+  open(REPORT, ">", $reportFile) or
+    die "cannot open output ($reportFile)\n";
+  printf REPORT "%-12s %-8s %6s %10s %10s %12s %12s\n", "stage", "status",
+    "jobs", "elapsed(s)", "cpu(s)", "input(MB)", "output(MB)";
+  foreach my $stage (@stages)
+  {
+    my $status = defined($stage->{status}) ? $stage->{status} : "not run";
+    my $elapsed = 0;
+    if (defined($stage->{startTime}))
+    {
+      my $end = defined($stage->{endTime}) ? $stage->{endTime} : time();
+      $elapsed = $end - $stage->{startTime};
+    }
+    printf REPORT "%-12s %-8s %6d %10.1f %10.1f %12.1f %12.1f\n",
+      $stage->{name}, $status, $stage->{jobCount} || 0, $elapsed,
+      $stage->{cpu} || 0, ($stage->{inputSize} || 0) / (1024 * 1024),
+      ($stage->{outputSize} || 0) / (1024 * 1024);
+  }
+  close(REPORT);
+}
+
+###########################################################################
+# Running the stages
+###########################################################################
+
+# a stage depends on the stages that write its inputs
+my %producer = ();
+foreach my $stage (@stages)
+{
+  foreach my $output (@{$stage->{outputs}})
+  {
+    $producer{$output} = $stage;
+  }
+}
+foreach my $stage (@stages)
+{
+  my %deps = ();
+  foreach my $input (@{$stage->{inputs}})
+  {
+    foreach my $output (keys %producer)
+    {
+      if ($input eq $output || index($input, "$output/") == 0)
+      {
+        if ($producer{$output} != $stage)
+        {
+          $deps{$producer{$output}->{name}} = $producer{$output};
+        }
+      }
+    }
+  }
+  $stage->{deps} = [ values %deps ];
+}
+
+system "mkdir -p $logDirectory";
+
+my @queue = ();        # jobs waiting for cores
+my %running = ();      # pid -> job
+my $coresInUse = 0;
+my $failed = 0;
+my $topDirectory = getcwd();
+
+# Decide whether a ready stage needs to run, and if so queue its jobs.
+sub startStage
+{
+  my $stage = $_[0];
+
+  $stage->{started} = 1;
+  $stage->{startTime} = time();
+  $stage->{cpu} = 0;
+  $stage->{jobCount} = 0;
+
+  my ($inputHash, $inputSize) = hashPaths(@{$stage->{inputs}});
+  $stage->{inputSize} = $inputSize;
+  my $signature = Digest::MD5::md5_hex(
+    (ref($stage->{command}) ? $stage->{params} : $stage->{command}) .
+    "\n$inputHash");
+  $stage->{signature} = $signature;
+
+  if (defined($state{$stage->{name}}))
+  {
+    my ($oldSignature, $oldOutputHash) = split / /, $state{$stage->{name}};
+    my ($outputHash, $outputSize) = hashPaths(@{$stage->{outputs}});
+    if ($oldSignature eq $signature && $oldOutputHash eq $outputHash)
+    {
+      print "Stage $stage->{name} is up to date.\n";
+      $stage->{status} = "skipped";
+      $stage->{outputSize} = $outputSize;
+      $stage->{endTime} = time();
+      $stage->{finished} = 1;
+      return;
+    }
+  }
+
+  print "Running stage $stage->{name}...\n";
+  delete $state{$stage->{name}};
+  writeState();
+
+  if (!$stage->{keepOutputs})
+  {
+    foreach my $output (@{$stage->{outputs}})
+    {
+      system "rm -rf $output";
+    }
+  }
+
+  my $command = ref($stage->{command}) ?
+    $stage->{command}->() : $stage->{command};
+  my $log = "$topDirectory/$logDirectory/$stage->{name}.log";
+  unlink($log);
+
+  my $stageCores = defined($stage->{cores}) ? $stage->{cores} : 1;
+  if ($stageCores > $cores)
+  {
+    $stageCores = $cores;
+  }
+
+  if (!defined($stage->{fanout}))
+  {
+    push @queue, { stage => $stage, dir => $stage->{dir},
+      command => $command, log => $log, cores => $stageCores };
+    $stage->{jobCount} = 1;
+  }
+  else
+  {
+    # a directory for each family, holding that family's files from each
+    # of the fanout directories (the first one determines the families)
+    my $work = "$workDirectory/$stage->{name}";
+    system "rm -rf $work";
+    system "mkdir -p $work";
+
+    my %families = ();
+    foreach my $fanout (@{$stage->{fanout}})
+    {
+      opendir(my $dh, $fanout) or
+        die "cannot open directory ($fanout)\n";
+      foreach my $file (grep { /^[^\.]/ } readdir($dh))
+      {
+        if ($file =~ /^([^\.]+)\./)
+        {
+          my $family = $1;
+          if ($fanout eq $stage->{fanout}->[0])
+          {
+            $families{$family} = 1;
+          }
+          elsif (!defined($families{$family}))
+          {
+            next;
+          }
+          my $unitDirectory = "$work/$family/" . basename($fanout);
+          system "mkdir -p $unitDirectory" if (! -d $unitDirectory);
+          symlink("$topDirectory/$fanout/$file", "$unitDirectory/$file") or
+            die "cannot link $fanout/$file into $unitDirectory\n";
+        }
+      }
+      closedir($dh);
+    }
+
+    foreach my $family (sort keys %families)
+    {
+      push @queue, { stage => $stage, dir => "$work/$family",
+        command => $command, log => $log, cores => 1 };
+      $stage->{jobCount} += 1;
+    }
+  }
+  $stage->{jobsLeft} = $stage->{jobCount};
+
+  if ($stage->{jobsLeft} == 0)
+  {
+    finishStage($stage);
+  }
+}
+
+# Gather the results of a fanned out stage, and record the stage's outputs.
+sub finishStage
+{
+  my $stage = $_[0];
+
+  if (defined($stage->{fanout}))
+  {
+    my $work = "$workDirectory/$stage->{name}";
+    foreach my $output (@{$stage->{outputs}})
+    {
+      my $outputName = basename($output);
+      system "mkdir -p $output";
+      opendir(my $units, $work) or
+        die "cannot open directory ($work)\n";
+      foreach my $family (grep { /^[^\.]/ } readdir($units))
+      {
+        my $from = "$work/$family/$outputName";
+        next if (! -d $from);
+        opendir(my $dh, $from) or
+          die "cannot open directory ($from)\n";
+        foreach my $file (grep { $_ ne "." && $_ ne ".." } readdir($dh))
+        {
+          rename("$from/$file", "$output/$file") or
+            die "rename of $from/$file to $output/$file failed!\n";
+        }
+        closedir($dh);
+      }
+      closedir($units);
+    }
+    system "rm -rf $work";
+  }
+
+  my ($outputHash, $outputSize) = hashPaths(@{$stage->{outputs}});
+  $stage->{outputSize} = $outputSize;
+  $state{$stage->{name}} = "$stage->{signature} $outputHash";
+  writeState();
+
+  $stage->{status} = "ran";
+  $stage->{endTime} = time();
+  $stage->{finished} = 1;
+  print "  Done with stage $stage->{name}.\n";
+}
+
+# Start a job, with its output going to the stage's log.
+sub launchJob
+{
+  my $job = $_[0];
+
+  my $pid = fork();
+  if (!defined($pid))
+  {
+    die "fork failed\n";
+  }
+  if ($pid == 0)
+  {
+    chdir($job->{dir}) or
+      die "FAILED: cd $job->{dir}\n";
+    open(STDOUT, ">>", $job->{log}) or
+      die "cannot open output ($job->{log})\n";
+    open(STDERR, ">&", \*STDOUT);
+    open(STDIN, "<", "/dev/null");
+    exec("/bin/sh", "-c", $job->{command});
+    die "exec of $job->{command} failed\n";
+  }
+
+  $running{$pid} = $job;
+  $coresInUse += $job->{cores};
+}
+
+while (1)
+{
+  # start the stages whose dependencies are finished
+  if (!$failed)
+  {
+    foreach my $stage (@stages)
+    {
+      next if ($stage->{started});
+      if (!grep { !$_->{finished} } @{$stage->{deps}})
+      {
+        startStage($stage);
+      }
+    }
+  }
+
+  # start jobs while there are cores (a job that needs more cores than
+  # there are can still run by itself)
+  while (!$failed && @queue > 0 &&
+         ($coresInUse == 0 || $coresInUse + $queue[0]->{cores} <= $cores))
+  {
+    launchJob(shift @queue);
+  }
+
+  if (keys(%running) == 0)
+  {
+    last;
+  }
+
+  # wait for a job to finish, and charge its CPU time to its stage
+  my (undef, undef, $userBefore, $systemBefore) = times();
+  my $pid = waitpid(-1, 0);
+  my $status = $?;
+  my (undef, undef, $userAfter, $systemAfter) = times();
+  my $job = $running{$pid};
+  next if (!defined($job));
+  delete $running{$pid};
+  $coresInUse -= $job->{cores};
+
+  my $stage = $job->{stage};
+  $stage->{cpu} += $userAfter - $userBefore + $systemAfter - $systemBefore;
+
+  if ($status != 0)
+  {
+    print STDERR "stage $stage->{name} failed (see $logDirectory/" .
+      "$stage->{name}.log)\n";
+    $stage->{status} = "failed";
+    $stage->{endTime} = time();
+    $failed = 1;
+    @queue = ();
+    next;
+  }
+
+  # (the stages still running when another fails are still recorded, so
+  # they need not be run again)
+  $stage->{jobsLeft} -= 1;
+  if ($stage->{jobsLeft} == 0 && !defined($stage->{status}))
+  {
+    finishStage($stage);
+  }
+}
+
+writeReport();
+
+if ($failed)
+{
+  die "Pipeline failed; run it again to restart from the failed stage.\n";
+}
+
+if (grep { !$_->{finished} } @stages)
+{
+  die "Pipeline did not finish all its stages!\n";
+}
+
+print "\nPipeline complete (see $reportFile).\n";